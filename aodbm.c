@@ -21,6 +21,14 @@
    a higher number means bigger files, longer writes, faster reads (to a point)
 */
 #define MAX_NODE_SIZE 4
+/* iterators hint this many bytes from the start of each node they are about
+   to visit, and look at most this many children ahead in a branch */
+#define READAHEAD_SPAN 4096
+#define MAX_READAHEAD 16
+#define READAHEAD_LEVELS 64
+/* how many milliseconds a reader waits for a starting writer to size the
+   shared head */
+#define HEAD_WAIT_TRIES 1000
 
 #include "string.h"
 #include "stdio.h"
@@ -29,30 +37,285 @@
 #include "assert.h"
 
 #include <arpa/inet.h>
-
-#define ntohll(x) ( ( (uint64_t)(ntohl( (uint32_t)((x << 32) >> 32) )) << 32) |\
-    ntohl( ((uint32_t)(x >> 32)) ) )                                        
-#define htonll(x) ntohll(x)
-
-#ifdef AODBM_USE_MMAP
+#include <sys/time.h>
+#include <sys/file.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 #include <unistd.h>
-#endif
+#include <fcntl.h>
+#include <errno.h>
+#include <sched.h>
+
+#define ntohll(x) ( ( (uint64_t)(ntohl( (uint32_t)(((x) << 32) >> 32) )) << 32) |\
+    ntohl( ((uint32_t)((x) >> 32)) ) )                                        
+#define htonll(x) ntohll(x)
 
 #include "aodbm.h"
 #include "aodbm_internal.h"
+#include "aodbm_node.h"
 
 #include "aodbm_error.h"
 
 uint64_t aodbm_file_size(aodbm *);
+void aodbm_index_commit(aodbm *, aodbm_version, uint64_t, uint64_t);
 
-aodbm *aodbm_open(const char *filename, int flags) {
+/* takes on the key order and width found in the file */
+void aodbm_adopt_order(aodbm *db, int order, uint32_t width) {
+    if (db->order_given && order != db->order) {
+        AODBM_CUSTOM_ERROR("error, the database was created with a different key order");
+    }
+    if (db->width_given && width != db->key_width) {
+        AODBM_CUSTOM_ERROR("error, the database was created with a different key width");
+    }
+    if (order < AODBM_ORDER_DEFAULT || order > AODBM_ORDER_CUSTOM) {
+        AODBM_CUSTOM_ERROR("error, unknown key order");
+    }
+    if (order == AODBM_ORDER_CUSTOM && db->compare == NULL) {
+        AODBM_CUSTOM_ERROR("error, the database's key order needs a comparator");
+    }
+    db->order = order;
+    db->key_width = width;
+}
+
+/* reads the blocks between begin and end, updating the current version for
+   each version block. returns the end of the last complete block */
+uint64_t aodbm_scan_blocks(aodbm *db, uint64_t begin, uint64_t end) {
+    uint64_t pos = begin;
+    aodbm_seek(db, begin, SEEK_SET);
+    while (pos < end) {
+        char type;
+        if (!aodbm_read_bytes(db, &type, 1)) {
+            break;
+        }
+        if (pos == 0 && type != 'h') {
+            /* the file was created before headers were written */
+            aodbm_adopt_order(db, AODBM_ORDER_DEFAULT, 0);
+        }
+        if (type == 'h') {
+            uint32_t header[2];
+            if (pos + 9 > end || !aodbm_read_bytes(db, header, 8)) {
+                break;
+            }
+            if (pos != 0) {
+                AODBM_CUSTOM_ERROR("error, found a header after the start of the file");
+            }
+            aodbm_adopt_order(db, ntohl(header[0]), ntohl(header[1]));
+            pos += 9;
+        } else if (type == 'v') {
+            /* update version */
+            uint64_t record[3];
+            if (pos + 25 > end || !aodbm_read_bytes(db, record, 24)) {
+                break;
+            }
+            if (ntohll(record[1]) != db->commits_sz + 1) {
+                AODBM_CUSTOM_ERROR("error, version record out of sequence");
+            }
+            db->cur = ntohll(record[0]);
+            aodbm_index_commit(db, db->cur, ntohll(record[1]), ntohll(record[2]));
+            pos += 25;
+        } else if (type == 'd') {
+            /* traverse data */
+            uint32_t sz;
+            if (pos + 5 > end || !aodbm_read_bytes(db, &sz, 4)) {
+                break;
+            }
+            sz = ntohl(sz);
+            if (pos + 5 + sz > end) {
+                break;
+            }
+            aodbm_seek(db, sz, SEEK_CUR);
+            pos += 5 + sz;
+        } else if (type == 'x') {
+            /* a value that leaves refer to */
+            uint32_t sz;
+            if (pos + 5 > end || !aodbm_read_bytes(db, &sz, 4)) {
+                break;
+            }
+            sz = ntohl(sz);
+            if (pos + 5 + sz > end) {
+                break;
+            }
+            aodbm_seek(db, sz, SEEK_CUR);
+            pos += 5 + sz;
+        } else if (type == 'z') {
+            /* a compression dictionary */
+            uint32_t sz;
+            if (pos + 5 > end || !aodbm_read_bytes(db, &sz, 4)) {
+                break;
+            }
+            sz = ntohl(sz);
+            aodbm_data *dict = malloc(sizeof(aodbm_data));
+            dict->sz = sz;
+            dict->dat = malloc(sz);
+            if (pos + 5 + sz > end || !aodbm_read_bytes(db, dict->dat, sz)) {
+                aodbm_free_data(dict);
+                break;
+            }
+            aodbm_add_dict(db, dict);
+            pos += 5 + sz;
+        } else {
+            AODBM_CUSTOM_ERROR("error, unknown block type");
+        }
+    }
+    return pos;
+}
+
+void aodbm_open_head(aodbm *db, const char *filename) {
+    char *name = malloc(strlen(filename) + 6);
+    strcpy(name, filename);
+    strcat(name, ".head");
+    if (db->reader) {
+        db->head_fd = open(name, O_RDONLY);
+    } else {
+        db->head_fd = open(name, O_RDWR | O_CREAT, 0644);
+    }
+    free(name);
+    if (db->head_fd == -1) {
+        AODBM_CUSTOM_ERROR("couldn't open the shared head");
+    }
+    
+    if (db->reader) {
+        /* a writer that is starting may not have sized the head yet, and
+           mapping it before then would fault on the first read */
+        struct stat st;
+        int tries = 0;
+        while (1) {
+            if (fstat(db->head_fd, &st) != 0) {
+                AODBM_OS_ERROR();
+            }
+            if (st.st_size >= (off_t)sizeof(aodbm_shared_head)) {
+                break;
+            }
+            if (++tries == HEAD_WAIT_TRIES) {
+                AODBM_CUSTOM_ERROR("error, the shared head hasn't been created by a writer");
+            }
+            usleep(1000);
+        }
+        db->head = mmap(NULL,
+                        sizeof(aodbm_shared_head),
+                        PROT_READ,
+                        MAP_SHARED,
+                        db->head_fd,
+                        0);
+    } else {
+        /* the lock is released when the process closes the file or exits */
+        if (flock(db->head_fd, LOCK_EX | LOCK_NB) != 0) {
+            AODBM_CUSTOM_ERROR("error, the database is open in another writer");
+        }
+        if (ftruncate(db->head_fd, sizeof(aodbm_shared_head)) != 0) {
+            AODBM_OS_ERROR();
+        }
+        db->head = mmap(NULL,
+                        sizeof(aodbm_shared_head),
+                        PROT_READ | PROT_WRITE,
+                        MAP_SHARED,
+                        db->head_fd,
+                        0);
+    }
+    if (db->head == MAP_FAILED) {
+        AODBM_OS_ERROR();
+    }
+}
+
+/* must be called with the version mutex held. end is the end of the last
+   block that has reached the file, other threads may be appending to it */
+void aodbm_publish_head(aodbm *db, uint64_t end) {
+    db->head->gen += 1;
+    __sync_synchronize();
+    db->head->file_size = end;
+    db->head->seq = db->commits_sz;
+    __sync_synchronize();
+    db->head->gen += 1;
+}
+
+/* the size of the file up to the last commit published by the writer */
+uint64_t aodbm_read_head(aodbm *db) {
+    while (1) {
+        uint64_t gen = db->head->gen;
+        __sync_synchronize();
+        uint64_t file_size = db->head->file_size;
+        __sync_synchronize();
+        if (gen % 2 == 0 && gen == db->head->gen) {
+            return file_size;
+        }
+        sched_yield();
+    }
+}
+
+/* brings a reader up to date with the commits published by the writer */
+void aodbm_refresh(aodbm *db) {
+    if (!db->reader) {
+        return;
+    }
+    pthread_mutex_lock(&db->version);
+    uint64_t end = aodbm_read_head(db);
+    if (end > db->file_size) {
+        pthread_mutex_lock(&db->rw);
+        uint64_t seq = db->commits_sz;
+        /* stop at the last complete block, the rest is read once it's
+           whole */
+        db->file_size = aodbm_scan_blocks(db, db->file_size, end);
+        pthread_mutex_unlock(&db->rw);
+        if (db->commits_sz != seq) {
+            pthread_cond_broadcast(&db->committed);
+        }
+    }
+    pthread_mutex_unlock(&db->version);
+}
+
+/* an order or width of -1 is taken from the file, or the default for a new
+   database */
+aodbm *aodbm_open_with(const char *filename,
+                       int flags,
+                       int order,
+                       aodbm_comparator compare,
+                       int64_t width) {
     aodbm *ptr = malloc(sizeof(aodbm));
     ptr->file_size = 0;
-    ptr->fd = fopen(filename, "a+b");
+    ptr->order_given = order != -1;
+    ptr->order = ptr->order_given ? order : AODBM_ORDER_DEFAULT;
+    ptr->compare = compare;
+    if (ptr->order == AODBM_ORDER_CUSTOM && compare == NULL) {
+        AODBM_CUSTOM_ERROR("error, a custom key order needs a comparator");
+    }
+    if (ptr->order == AODBM_ORDER_U64 || ptr->order == AODBM_ORDER_I64) {
+        if (width != -1 && width != 8) {
+            AODBM_CUSTOM_ERROR("error, integer ordered keys are 8 bytes long");
+        }
+        width = 8;
+    }
+    ptr->width_given = width != -1;
+    ptr->key_width = ptr->width_given ? width : 0;
+    ptr->dicts_sz = 0;
+    ptr->compress = (flags & AODBM_COMPRESS) != 0;
+    #ifndef AODBM_USE_ZLIB
+    if (ptr->compress) {
+        AODBM_CUSTOM_ERROR("error, aodbm was built without compression");
+    }
+    #endif
+    ptr->node_cache = aodbm_new_node_cache();
+    ptr->dedup = (flags & AODBM_DEDUP) != 0;
+    ptr->node_align = 0;
+    ptr->value_index = NULL;
+    if (ptr->dedup) {
+        ptr->value_index =
+            calloc(AODBM_VALUE_INDEX_SIZE, sizeof(aodbm_value_slot));
+    }
+    ptr->reader = (flags & AODBM_READER) != 0;
+    ptr->read_only = (flags & (AODBM_FOLLOWER | AODBM_READER)) != 0;
+    ptr->head = NULL;
+    if (ptr->reader) {
+        ptr->fd = fopen(filename, "rb");
+    } else {
+        ptr->fd = fopen(filename, "a+b");
+    }
     if (ptr->fd == NULL) {
         AODBM_CUSTOM_ERROR("couldn't open file");
     }
+    if (flags & (AODBM_SHARED | AODBM_READER)) {
+        /* the writer has to hold the lock before the file is scanned */
+        aodbm_open_head(ptr, filename);
+    }
     
     pthread_mutexattr_t rec;
     pthread_mutexattr_init(&rec);
@@ -60,52 +323,44 @@ aodbm *aodbm_open(const char *filename, int flags) {
     
     pthread_mutex_init(&ptr->rw, &rec);
     pthread_mutex_init(&ptr->version, NULL);
+    pthread_cond_init(&ptr->committed, NULL);
     
     pthread_mutexattr_destroy(&rec);
     
     aodbm_seek(ptr, 0, SEEK_END);
     uint64_t actual_size = aodbm_tell(ptr);
     
-    aodbm_seek(ptr, 0, SEEK_SET);
     ptr->cur = 0;
-    while(1) {
-        char type;
-        uint64_t block_begin = ptr->file_size;
-        if (!aodbm_read_bytes(ptr, &type, 1)) {
-            break;
+    ptr->commits = NULL;
+    ptr->commits_sz = 0;
+    ptr->commits_cap = 0;
+    if (ptr->reader) {
+        /* only read as far as the writer has committed */
+        actual_size = aodbm_read_head(ptr);
+        ptr->file_size = aodbm_scan_blocks(ptr, 0, actual_size);
+    } else {
+        ptr->file_size = aodbm_scan_blocks(ptr, 0, actual_size);
+        if (ptr->file_size != actual_size) {
+            /* remove an incomplete block left by an interrupted write */
+            aodbm_truncate(ptr, ptr->file_size);
         }
-        ptr->file_size += 1;
-        if (type == 'v') {
-            /* update version */
-            uint64_t ver;
-            if (!aodbm_read_bytes(ptr, &ver, 8)) {
-                aodbm_truncate(ptr, block_begin);
-                break;
-            }
-            ptr->cur = ntohll(ver);
-            ptr->file_size += 8;
-        } else if (type == 'd') {
-            /* traverse data */
-            uint32_t sz;
-            if (!aodbm_read_bytes(ptr, &sz, 4)) {
-                aodbm_truncate(ptr, block_begin);
-                break;
-            }
-            ptr->file_size += 4;
-            sz = ntohl(sz);
-            if (ptr->file_size + sz > actual_size) {
-                aodbm_truncate(ptr, block_begin);
-                break;
-            }
-            aodbm_seek(ptr, sz, SEEK_CUR);
-            ptr->file_size += sz;
-        } else {
-            AODBM_CUSTOM_ERROR("error, unknown block type");
+        if (ptr->file_size == 0 && !ptr->read_only) {
+            /* a new database, record its key order. followers get theirs
+               from the primary */
+            uint32_t header[2];
+            header[0] = htonl(ptr->order);
+            header[1] = htonl(ptr->key_width);
+            aodbm_write_bytes(ptr, "h", 1);
+            aodbm_write_bytes(ptr, header, 8);
+            fflush(ptr->fd);
         }
     }
+    if (ptr->head != NULL && !ptr->reader) {
+        aodbm_publish_head(ptr, ptr->file_size);
+    }
     
     #ifdef AODBM_USE_MMAP
-    aodbm_rwlock_init(&ptr->mmap_mut);
+    aodbm_brlock_init(&ptr->mmap_mut);
     /* create mapping */
     long page_size = sysconf(_SC_PAGE_SIZE);
     
@@ -125,12 +380,43 @@ aodbm *aodbm_open(const char *filename, int flags) {
     return ptr;
 }
 
+aodbm *aodbm_open(const char *filename, int flags) {
+    return aodbm_open_with(filename, flags, -1, NULL, -1);
+}
+
+aodbm *aodbm_open_ordered(const char *filename,
+                          int flags,
+                          int order,
+                          aodbm_comparator compare) {
+    return aodbm_open_with(filename, flags, order, compare, -1);
+}
+
+aodbm *aodbm_open_fixed(const char *filename,
+                        int flags,
+                        int order,
+                        aodbm_comparator compare,
+                        uint32_t width) {
+    return aodbm_open_with(filename, flags, order, compare, width);
+}
+
 void aodbm_close(aodbm *db) {
     fclose(db->fd);
+    if (db->head != NULL) {
+        munmap(db->head, sizeof(aodbm_shared_head));
+        close(db->head_fd);
+    }
     pthread_mutex_destroy(&db->rw);
     pthread_mutex_destroy(&db->version);
+    pthread_cond_destroy(&db->committed);
+    free(db->commits);
+    uint32_t i;
+    for (i = 0; i < db->dicts_sz; ++i) {
+        aodbm_free_data(db->dicts[i]);
+    }
+    aodbm_free_node_cache(db->node_cache);
+    free(db->value_index);
     #ifdef AODBM_USE_MMAP
-    aodbm_rwlock_destroy(&db->mmap_mut);
+    aodbm_brlock_destroy(&db->mmap_mut);
     munmap((void *)db->mapping, db->mapping_size);
     #endif
     free(db);
@@ -142,20 +428,57 @@ uint64_t aodbm_file_size(aodbm *db) {
 
 uint64_t aodbm_current(aodbm *db) {
     uint64_t result;
+    aodbm_refresh(db);
     pthread_mutex_lock(&db->version);
     result = db->cur;
     pthread_mutex_unlock(&db->version);
     return result;
 }
 
+void aodbm_index_commit(aodbm *db,
+                        aodbm_version ver,
+                        uint64_t seq,
+                        uint64_t time) {
+    if (db->commits_sz == db->commits_cap) {
+        db->commits_cap = db->commits_cap == 0 ? 64 : db->commits_cap * 2;
+        db->commits = realloc(db->commits,
+                              sizeof(aodbm_commit_record) * db->commits_cap);
+    }
+    db->commits[seq - 1].ver = ver;
+    db->commits[seq - 1].time = time;
+    db->commits_sz = seq;
+}
+
+/* must be called with the version mutex held */
+void aodbm_record_commit(aodbm *db, aodbm_version ver) {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    uint64_t time = (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+    /* keep the commit times ordered, even if the clock goes backwards */
+    if (db->commits_sz != 0 && db->commits[db->commits_sz - 1].time > time) {
+        time = db->commits[db->commits_sz - 1].time;
+    }
+    uint64_t seq = db->commits_sz + 1;
+    
+    /* write the new head */
+    uint64_t end = aodbm_write_version(db, ver, seq, time);
+    aodbm_index_commit(db, ver, seq, time);
+    db->cur = ver;
+    if (db->head != NULL) {
+        aodbm_publish_head(db, end);
+    }
+    pthread_cond_broadcast(&db->committed);
+}
+
 bool aodbm_commit(aodbm *db, uint64_t version) {
     bool result;
+    if (db->read_only) {
+        return false;
+    }
     pthread_mutex_lock(&db->version);
     result = aodbm_is_based_on(db, version, db->cur);
     if (result) {
-        /* write the new head */
-        aodbm_write_version(db, version);
-        db->cur = version;
+        aodbm_record_commit(db, version);
     }
     pthread_mutex_unlock(&db->version);
     return result;
@@ -163,12 +486,15 @@ bool aodbm_commit(aodbm *db, uint64_t version) {
 
 bool aodbm_commit_init(aodbm *db, uint64_t version) {
     pthread_mutex_lock(&db->version);
+    /* the caller still ends with aodbm_commit_abort */
+    if (db->read_only) {
+        return false;
+    }
     return aodbm_is_based_on(db, version, db->cur);
 }
 
 void aodbm_commit_finish(aodbm *db, uint64_t version) {
-    aodbm_write_version(db, version);
-    db->cur = version;
+    aodbm_record_commit(db, version);
     pthread_mutex_unlock(&db->version);
 }
 
@@ -176,389 +502,439 @@ void aodbm_commit_abort(aodbm *db) {
     pthread_mutex_unlock(&db->version);
 }
 
-aodbm_rope *aodbm_branch_di(uint64_t a, aodbm_data *key, uint64_t b) {
-    aodbm_rope *br = aodbm_data2_to_rope_di(aodbm_data_from_str("b"),
-                                            aodbm_data_from_32(1));
-    aodbm_rope_append_di(br, aodbm_data_from_64(a));
-    br = aodbm_rope_merge_di(br, make_block_di(key));
-    aodbm_rope_append_di(br, aodbm_data_from_64(b));
-    return br;
-}
-
-aodbm_rope *aodbm_leaf_node(aodbm_data *key, aodbm_data *val) {
-    aodbm_rope *node = aodbm_data2_to_rope_di(aodbm_data_from_str("l"),
-                                              aodbm_data_from_32(1));
-    return aodbm_rope_merge_di(node, make_record(key, val));
+uint64_t aodbm_current_seq(aodbm *db) {
+    uint64_t result;
+    aodbm_refresh(db);
+    pthread_mutex_lock(&db->version);
+    result = db->commits_sz;
+    pthread_mutex_unlock(&db->version);
+    return result;
 }
 
-typedef struct {
-    aodbm_rope *node;
-    aodbm_data *key;
-    uint64_t end_pos;
-    uint32_t sz;
-    bool inserted;
-} range_result;
-
-range_result add_header(range_result result) {
-    aodbm_rope *header = aodbm_data2_to_rope_di(aodbm_data_from_str("l"),
-                                                aodbm_data_from_32(result.sz));
-    result.node = aodbm_rope_merge_di(header, result.node);
+aodbm_version aodbm_version_at_seq(aodbm *db, uint64_t seq) {
+    aodbm_version result = 0;
+    aodbm_refresh(db);
+    pthread_mutex_lock(&db->version);
+    /* a follower may be asked for a commit that it hasn't received yet */
+    if (seq != 0 && seq <= db->commits_sz) {
+        result = db->commits[seq - 1].ver;
+    }
+    pthread_mutex_unlock(&db->version);
     return result;
 }
 
-range_result duplicate_leaf_range(aodbm *db,
-                                  uint64_t start_pos,
-                                  uint32_t num) {
-    aodbm_rope *data = aodbm_rope_empty();
-    aodbm_data *key1;
-    uint64_t pos = start_pos;
-    uint32_t i;
-    for (i = 0; i < num; ++i) {
-        aodbm_data *d_key = aodbm_read_data(db, pos);
-        pos += d_key->sz + 4;
-        aodbm_data *d_val = aodbm_read_data(db, pos);
-        pos += d_val->sz + 4;
-        
-        if (i == 0) {
-            key1 = aodbm_data_dup(d_key);
-        }
-        data = aodbm_rope_merge_di(data, make_record_di(d_key, d_val));
+uint64_t aodbm_commit_time(aodbm *db, uint64_t seq) {
+    uint64_t result = 0;
+    aodbm_refresh(db);
+    pthread_mutex_lock(&db->version);
+    if (seq != 0 && seq <= db->commits_sz) {
+        result = db->commits[seq - 1].time;
     }
-    
-    range_result result;
-    result.node = data;
-    result.key = key1;
-    result.end_pos = pos;
-    result.sz = num;
-    result.inserted = false;
+    pthread_mutex_unlock(&db->version);
     return result;
 }
 
-range_result insert_into_leaf_range(aodbm *db,
-                                    aodbm_data *key,
-                                    aodbm_data *val,
-                                    uint64_t start_pos,
-                                    uint32_t num,
-                                    bool insert_end) {
-    bool inserted;
-    aodbm_rope *data = aodbm_rope_empty();
-    aodbm_data *key1 = NULL;
-    aodbm_rope *i_rec = make_record(key, val);
-    uint64_t pos = start_pos;
-    uint32_t i;
-    for (i = 0; i < num; ++i) {
-        aodbm_data *d_key = aodbm_read_data(db, pos);
-        pos += d_key->sz + 4;
-        aodbm_data *d_val = aodbm_read_data(db, pos);
-        pos += d_val->sz + 4;
-        
-        int cmp = aodbm_data_cmp(key, d_key);
-        if (cmp == -1) {
-            inserted = true;
-        }
-        if (cmp == 0) {
-            inserted = false;
-        }
-        if (cmp != 1) {
-            data = aodbm_rope_merge_di(data, i_rec);
-            if (i == 0) {
-                key1 = aodbm_data_dup(key);
-            }
-        }
-        if (cmp != 0) {
-            if (key1 == NULL && i == 0) {
-                key1 = aodbm_data_dup(d_key);
-            }
-            data = aodbm_rope_merge_di(data, make_record_di(d_key, d_val));
-        } else {
-            aodbm_free_data(d_key);
-            aodbm_free_data(d_val);
-        }
-        if (cmp != 1) {
-            break;
-        }
-    }
-    range_result result;
-    result.key = key1;
-    result.inserted = true;
-    if (i < num) {
-        /* the loop was broken */
-        if (num - i != 1) {
-            range_result dup = duplicate_leaf_range(db, pos, num - i - 1);
-            aodbm_free_data(dup.key);
-        
-            result.node = aodbm_rope_merge_di(data, dup.node);
-            result.end_pos = dup.end_pos;
-        } else {
-            result.node = data;
-            result.end_pos = pos;
-        }
-        result.sz = num + (inserted?1:0);
-    } else {
-        if (insert_end) {
-            result.node = aodbm_rope_merge_di(data, i_rec);
-            result.sz = num + 1;
+uint64_t aodbm_seq_at_time(aodbm *db, uint64_t time) {
+    aodbm_refresh(db);
+    pthread_mutex_lock(&db->version);
+    /* find the number of commits made at or before the given time */
+    uint64_t lo = 0, hi = db->commits_sz;
+    while (lo < hi) {
+        uint64_t mid = lo + (hi - lo) / 2;
+        if (db->commits[mid].time <= time) {
+            lo = mid + 1;
         } else {
-            aodbm_free_rope(i_rec);
-            result.node = data;
-            result.inserted = false;
-            result.sz = num;
+            hi = mid;
         }
-        result.end_pos = pos;
     }
-    return result;
+    pthread_mutex_unlock(&db->version);
+    return lo;
 }
 
+aodbm_version aodbm_version_at_time(aodbm *db, uint64_t time) {
+    return aodbm_version_at_seq(db, aodbm_seq_at_time(db, time));
+}
+
+/* a branch with two children, that will be written at off */
+aodbm_rope *aodbm_branch_di(aodbm *db,
+                            uint64_t a,
+                            uint64_t a_count,
+                            aodbm_data *key,
+                            uint64_t b,
+                            uint64_t b_count,
+                            uint64_t off) {
+    uint64_t offs[2], counts[2];
+    offs[0] = a;
+    offs[1] = b;
+    counts[0] = a_count;
+    counts[1] = b_count;
+    aodbm_rope *br = aodbm_encode_branch(db, key, offs, counts, 1, off);
+    aodbm_free_data(key);
+    return br;
+}
+
+aodbm_rope *aodbm_leaf_node(aodbm *db,
+                            aodbm_data *key,
+                            aodbm_data *val,
+                            uint64_t ref) {
+    return aodbm_encode_leaf(db, key, val, ref != 0 ? &ref : NULL, 1);
+}
+
+/* up to two nodes that replace a node, with their lower bounds, the number
+   of records under them and the padding to write before each of them */
 typedef struct {
     aodbm_rope *a_node;
     aodbm_data *a_key;
+    uint64_t a_count;
+    uint32_t a_pad;
     aodbm_rope *b_node;
     aodbm_data *b_key;
+    uint64_t b_count;
+    uint32_t b_pad;
 } modify_result;
 
-/* pos is positioned just after the type byte */
+/* the padding to put before sz bytes written at off, so that they don't
+   cross a multiple of the node alignment. nodes that are bigger than the
+   alignment aren't padded */
+static uint32_t node_padding(aodbm *db, uint64_t off, uint64_t sz) {
+    uint64_t align = db->node_align;
+    if (align == 0 || sz > align || off % align + sz <= align) {
+        return 0;
+    }
+    return align - off % align;
+}
+
+static void append_padding(aodbm_rope **data,
+                           uint64_t *data_sz,
+                           uint32_t pad) {
+    if (pad != 0) {
+        aodbm_data *zeros = malloc(sizeof(aodbm_data));
+        zeros->sz = pad;
+        zeros->dat = calloc(pad, 1);
+        aodbm_rope_append_di(*data, zeros);
+        *data_sz += pad;
+    }
+}
+
+/* appends a node and the padding before it to data, returns the offset of
+   the node */
+static uint64_t append_node(aodbm_rope **data,
+                            uint64_t *data_sz,
+                            uint64_t append_pos,
+                            aodbm_rope *node,
+                            uint32_t pad) {
+    append_padding(data, data_sz, pad);
+    uint64_t off = *data_sz + append_pos;
+    *data_sz += aodbm_rope_size(node);
+    *data = aodbm_rope_merge_di(*data, node);
+    return off;
+}
+
+/* encodes the records of a leaf, splitting it in two if it's too big. lower
+   is the key that the leaf's parent separates it from its left sibling with,
+   it is kept as the leaf's key so that separators stay short, or NULL to use
+   the leaf's first key. refs is like aodbm_node's refs. the leaves will be
+   written from pos onwards, a root that isn't split after its version
+   header */
+modify_result split_leaf(aodbm *db,
+                         aodbm_data *lower,
+                         aodbm_data *keys,
+                         aodbm_data *vals,
+                         uint64_t *refs,
+                         uint32_t sz,
+                         uint64_t pos,
+                         bool root) {
+    modify_result result;
+    result.a_pad = 0;
+    result.b_node = NULL;
+    result.b_key = NULL;
+    result.b_count = 0;
+    result.b_pad = 0;
+    if (sz == 0) {
+        result.a_node = NULL;
+        result.a_key = NULL;
+        result.a_count = 0;
+    } else if (sz <= MAX_NODE_SIZE) {
+        result.a_node = aodbm_encode_leaf(db, keys, vals, refs, sz);
+        result.a_key = aodbm_data_dup(lower != NULL ? lower : &keys[0]);
+        result.a_count = sz;
+        uint64_t a_sz = aodbm_rope_size(result.a_node);
+        if (root) {
+            a_sz += AODBM_VERSION_HEADER_SIZE;
+        }
+        result.a_pad = node_padding(db, pos, a_sz);
+    } else {
+        uint32_t half = sz / 2;
+        result.a_node = aodbm_encode_leaf(db, keys, vals, refs, half);
+        result.a_key = aodbm_data_dup(lower != NULL ? lower : &keys[0]);
+        result.a_count = half;
+        result.b_node = aodbm_encode_leaf(db,
+                                          keys + half,
+                                          vals + half,
+                                          refs != NULL ? refs + half : NULL,
+                                          sz - half);
+        result.b_key = aodbm_key_separator(db, &keys[half - 1], &keys[half]);
+        result.b_count = sz - half;
+        uint64_t a_sz = aodbm_rope_size(result.a_node);
+        result.a_pad = node_padding(db, pos, a_sz);
+        pos += result.a_pad + a_sz;
+        result.b_pad = node_padding(db, pos, aodbm_rope_size(result.b_node));
+    }
+    return result;
+}
+
+/* ref is the offset of val if it is stored apart from the leaf, or 0. pos
+   and root are as for split_leaf */
 modify_result insert_into_leaf(aodbm *db,
+                               aodbm_data *lower,
                                aodbm_data *key,
                                aodbm_data *val,
-                               uint64_t pos) {
-    uint32_t sz = aodbm_read32(db, pos);
-    pos += 4;
-    if (sz == MAX_NODE_SIZE) {
-        range_result a_range =
-            add_header(
-                insert_into_leaf_range(db, key, val, pos, MAX_NODE_SIZE/2, false));
-        range_result b_range;
-        if (a_range.inserted) {
-            b_range =
-                add_header(
-                    duplicate_leaf_range(db, a_range.end_pos, MAX_NODE_SIZE/2));
-        } else {
-            b_range = add_header(insert_into_leaf_range(db,
-                                                   key,
-                                                   val,
-                                                   a_range.end_pos,
-                                                   MAX_NODE_SIZE/2,
-                                                   true));
-        }
-        modify_result result;
-        result.a_node = a_range.node;
-        result.a_key = a_range.key;
-        result.b_node = b_range.node;
-        result.b_key = b_range.key;
-        return result;
-    } else if (sz == 0) {
-        modify_result result;
-        result.a_node = aodbm_leaf_node(key, val);
-        result.a_key = aodbm_data_dup(key);
-        result.b_node = NULL;
-        result.b_key = NULL;
-        return result;
-    } else if (sz < MAX_NODE_SIZE) {
-        range_result range =
-            add_header(insert_into_leaf_range(db, key, val, pos, sz, true));
-        modify_result result;
-        result.a_node = range.node;
-        result.a_key = range.key;
-        result.b_node = NULL;
-        result.b_key = NULL;
-        return result;
-    } else {
-        AODBM_CUSTOM_ERROR("found a node with a size beyond MAX_NODE_SIZE");
+                               uint64_t ref,
+                               uint64_t leaf,
+                               uint64_t pos,
+                               bool root) {
+    aodbm_node *node = aodbm_read_node(db, leaf, true);
+    uint32_t i = aodbm_node_lower_bound(db, node, key);
+    bool replace = i < node->sz && aodbm_data_eq(&node->keys[i], key);
+    uint32_t sz = node->sz + (replace ? 0 : 1);
+    
+    aodbm_data *keys = malloc(sizeof(aodbm_data) * sz);
+    aodbm_data *vals = malloc(sizeof(aodbm_data) * sz);
+    memcpy(keys, node->keys, sizeof(aodbm_data) * i);
+    memcpy(vals, node->vals, sizeof(aodbm_data) * i);
+    keys[i] = *key;
+    vals[i] = *val;
+    uint32_t rest = node->sz - i - (replace ? 1 : 0);
+    memcpy(keys + i + 1, node->keys + node->sz - rest, sizeof(aodbm_data) * rest);
+    memcpy(vals + i + 1, node->vals + node->sz - rest, sizeof(aodbm_data) * rest);
+    uint64_t *refs = NULL;
+    if (node->refs != NULL || ref != 0) {
+        refs = calloc(sz, sizeof(uint64_t));
+        if (node->refs != NULL) {
+            memcpy(refs, node->refs, sizeof(uint64_t) * i);
+            memcpy(refs + i + 1,
+                   node->refs + node->sz - rest,
+                   sizeof(uint64_t) * rest);
+        }
+        refs[i] = ref;
     }
+    
+    modify_result result =
+        split_leaf(db, lower, keys, vals, refs, sz, pos, root);
+    free(keys);
+    free(vals);
+    free(refs);
+    aodbm_free_node(node);
+    return result;
 }
 
 modify_result remove_from_leaf(aodbm *db,
+                               aodbm_data *lower,
                                aodbm_data *key,
-                               uint64_t pos) {
-    modify_result result;
-    result.a_key = NULL;
-    result.b_key = NULL;
-    result.b_node = NULL;
-    aodbm_rope *data = aodbm_rope_empty();
-    uint32_t sz = aodbm_read32(db, pos);
-    pos += 4;
-    
-    uint32_t i;
-    bool removed = false;
-    for (i = 0; i < sz; ++i) {
-        aodbm_data *r_key = aodbm_read_data(db, pos);
-        pos += 4 + r_key->sz;
-        aodbm_data *r_val = aodbm_read_data(db, pos);
-        pos += 4 + r_val->sz;
-        
-        if (!removed) {
-            if (!aodbm_data_eq(r_key, key)) {
-                if (result.a_key == NULL) {
-                    result.a_key = aodbm_data_dup(r_key);
-                }
-                data = aodbm_rope_merge_di(data, make_record_di(r_key, r_val));
-            } else {
-                removed = true;
-                aodbm_free_data(r_key);
-                aodbm_free_data(r_val);
-            }
-        } else {
-            if (result.a_key == NULL) {
-                result.a_key = aodbm_data_dup(r_key);
-            }
-            data = aodbm_rope_merge_di(data, make_record_di(r_key, r_val));
+                               uint64_t leaf,
+                               uint64_t pos,
+                               bool root) {
+    aodbm_node *node = aodbm_read_node(db, leaf, true);
+    int64_t i = aodbm_node_find(db, node, key);
+    if (i != -1) {
+        memmove(node->keys + i,
+                node->keys + i + 1,
+                sizeof(aodbm_data) * (node->sz - i - 1));
+        memmove(node->vals + i,
+                node->vals + i + 1,
+                sizeof(aodbm_data) * (node->sz - i - 1));
+        if (node->refs != NULL) {
+            memmove(node->refs + i,
+                    node->refs + i + 1,
+                    sizeof(uint64_t) * (node->sz - i - 1));
         }
+        node->sz -= 1;
     }
-    
-    aodbm_rope *header =
-        aodbm_data2_to_rope_di(aodbm_data_from_str("l"),
-                               aodbm_data_from_32(sz - (removed?1:0)));
-    
-    result.a_node = aodbm_rope_merge_di(header, data);
+    modify_result result = split_leaf(db,
+                                      lower,
+                                      node->keys,
+                                      node->vals,
+                                      node->refs,
+                                      node->sz,
+                                      pos,
+                                      root);
+    aodbm_free_node(node);
     return result;
 }
 
+/* the children of a branch, keys[0] is the lower bound of the branch */
 typedef struct {
-    aodbm_rope *data;
-    aodbm_data *key;
+    aodbm_data *keys;
+    uint64_t *offs;
+    uint64_t *counts;
     uint32_t sz;
 } branch;
 
-void branch_init(branch *br) {
-    br->data = NULL;
-    br->key = NULL;
-    br->sz = 0;
+static void add_to_branch(branch *br,
+                          aodbm_data *key,
+                          uint64_t off,
+                          uint64_t count) {
+    br->keys[br->sz] = *key;
+    br->offs[br->sz] = off;
+    br->counts[br->sz] = count;
+    br->sz += 1;
 }
 
-void add_to_branch_di(branch *node, aodbm_data *key, uint64_t off) {
-    aodbm_data *d_off = aodbm_data_from_64(off);
-    if (node->key == NULL) {
-        node->key = key;
-        node->data = aodbm_data_to_rope_di(d_off);
-    } else {
-        aodbm_rope *rec = make_block_di(key);
-        aodbm_rope_append_di(rec, d_off);
-        node->data = aodbm_rope_merge_di(node->data, rec);
-    }
-    node->sz += 1;
-}
-
-void add_to_branch(branch *node, aodbm_data *key, uint64_t off) {
-    add_to_branch_di(node, aodbm_data_dup(key), off);
-}
-
-void add_to_branches_di(branch *a, branch *b, aodbm_data *key, uint64_t off) {
-    if (a->sz < MAX_NODE_SIZE/2) {
-        add_to_branch_di(a, key, off);
-    } else {
-        add_to_branch_di(b, key, off);
+/* encodes the children from begin to end as a branch that will be written
+   at off, count is set to the number of records under it */
+static aodbm_rope *encode_branch_range(aodbm *db,
+                                       branch *br,
+                                       uint32_t begin,
+                                       uint32_t end,
+                                       uint64_t *count,
+                                       uint64_t off) {
+    uint32_t i;
+    *count = 0;
+    for (i = begin; i < end; ++i) {
+        *count += br->counts[i];
     }
+    /* the first key is the lower bound, it isn't stored */
+    return aodbm_encode_branch(db,
+                               br->keys + begin + 1,
+                               br->offs + begin,
+                               br->counts + begin,
+                               end - begin - 1,
+                               off);
 }
 
-void add_to_branches(branch *a, branch *b, aodbm_data *key, uint64_t off) {
-    add_to_branches_di(a, b, aodbm_data_dup(key), off);
-}
-
-void merge_branches(branch *a, branch *b) {
-    if (b->sz > 0) {
-        a->sz += b->sz;
-        a->data = aodbm_rope_merge_di(a->data, make_block_di(b->key));
-        a->data = aodbm_rope_merge_di(a->data, b->data);
-        b->sz = 0;
+/* like encode_branch_range, for a branch that will be written after header
+   bytes at pos, or after the padding that pad is set to. a branch's size
+   depends on where it is, so it is encoded again if it has to move */
+static aodbm_rope *place_branch_range(aodbm *db,
+                                      branch *br,
+                                      uint32_t begin,
+                                      uint32_t end,
+                                      uint64_t *count,
+                                      uint64_t pos,
+                                      uint32_t header,
+                                      uint32_t *pad) {
+    aodbm_rope *node =
+        encode_branch_range(db, br, begin, end, count, pos + header);
+    *pad = node_padding(db, pos, header + aodbm_rope_size(node));
+    if (*pad != 0) {
+        aodbm_free_rope(node);
+        node = encode_branch_range(db,
+                                   br,
+                                   begin,
+                                   end,
+                                   count,
+                                   pos + *pad + header);
     }
+    return node;
 }
 
-aodbm_rope *branch_to_rope(branch *br) {
-    aodbm_rope *header = aodbm_data2_to_rope_di(aodbm_data_from_str("b"),
-                                                aodbm_data_from_32(br->sz - 1));
-    return aodbm_rope_merge_di(header, br->data);
-}
-
+/*
+  rebuilds a branch with the children rm_a and rm_b removed and node_a and
+  node_b (if their keys aren't NULL) put in their places, splitting it in two
+  if it's too big. a_key and b_key are freed, a_count and b_count are the
+  number of records under node_a and node_b. the new branches will be
+  written from pos onwards, except that a root that isn't split is written
+  after its version header. they are padded so that they don't cross a
+  multiple of the node alignment
+*/
 modify_result modify_branch(aodbm *db,
                             uint64_t node,
                             aodbm_data *node_key,
                             uint64_t node_a,
                             aodbm_data *a_key,
+                            uint64_t a_count,
                             uint64_t node_b,
                             aodbm_data *b_key,
+                            uint64_t b_count,
                             uint64_t rm_a,
-                            uint64_t rm_b) {
-    branch a, b;
-    branch_init(&a);
-    branch_init(&b);
-    
-    uint64_t pos = node + 1;
-    uint32_t sz = aodbm_read32(db, pos);
-    pos += 4;
+                            uint64_t rm_b,
+                            uint64_t pos,
+                            bool root) {
+    aodbm_node *old = aodbm_read_node(db, node, true);
+    branch br;
+    br.keys = malloc(sizeof(aodbm_data) * (old->sz + 3));
+    br.offs = malloc(sizeof(uint64_t) * (old->sz + 3));
+    br.counts = malloc(sizeof(uint64_t) * (old->sz + 3));
+    br.sz = 0;
     
-    uint64_t off = aodbm_read64(db, pos);
-    pos += 8;
-    
-    uint32_t i;
     bool a_placed = a_key == NULL;
     bool b_placed = b_key == NULL;
-    
-    if (off != rm_a && off != rm_b) {
-        add_to_branches(&a, &b, node_key, off);
-    }
-    
-    for (i = 0; i < sz; ++i) {
-        aodbm_data *key = aodbm_read_data(db, pos);
-        pos += 4 + key->sz;
-        off = aodbm_read64(db, pos);
-        pos += 8;
-        
-        if (!a_placed) {
-            if (aodbm_data_lt(a_key, key)) {
+    uint32_t i;
+    for (i = 0; i <= old->sz; ++i) {
+        aodbm_data *key = i == 0 ? node_key : &old->keys[i - 1];
+        if (i != 0) {
+            if (!a_placed && aodbm_key_lt(db, a_key, key)) {
                 a_placed = true;
-                add_to_branches(&a, &b, a_key, node_a);
-            }
-            if (!b_placed) {
-                if (aodbm_data_lt(b_key, key)) {
-                    b_placed = true;
-                    add_to_branches(&a, &b, b_key, node_b);
-                }
+                add_to_branch(&br, a_key, node_a, a_count);
             }
-        } else {
-            if (!b_placed) {
-                if (aodbm_data_lt(b_key, key)) {
-                    b_placed = true;
-                    add_to_branches(&a, &b, b_key, node_b);
-                }
+            if (!b_placed && aodbm_key_lt(db, b_key, key)) {
+                b_placed = true;
+                add_to_branch(&br, b_key, node_b, b_count);
             }
         }
-        
-        if (off != rm_a && off != rm_b) {
-            add_to_branches_di(&a, &b, key, off);
-        } else {
-            aodbm_free_data(key);
+        if (old->offs[i] != rm_a && old->offs[i] != rm_b) {
+            add_to_branch(&br, key, old->offs[i], old->counts[i]);
         }
     }
-    
     if (!a_placed) {
-        add_to_branches(&a, &b, a_key, node_a);
+        add_to_branch(&br, a_key, node_a, a_count);
     }
     if (!b_placed) {
-        add_to_branches(&a, &b, b_key, node_b);
+        add_to_branch(&br, b_key, node_b, b_count);
     }
     
     modify_result result;
-    if (b.sz < MAX_NODE_SIZE/2) {
-        merge_branches(&a, &b);
-        if (a.sz == 0) {
-            result.a_node = NULL;
-            result.a_key = NULL;
-            result.b_node = NULL;
-            result.b_key = NULL;
-        } /*else if (a.sz == 1) {
-            printf("error, special case 2\n");
-            exit(1);
-        } */ else {
-            result.a_node = branch_to_rope(&a);
-            result.a_key = a.key;
-            result.b_node = NULL;
-            result.b_key = NULL;
-        }
+    result.a_pad = 0;
+    result.b_node = NULL;
+    result.b_key = NULL;
+    result.b_count = 0;
+    result.b_pad = 0;
+    uint32_t half = MAX_NODE_SIZE/2;
+    if (br.sz == 0) {
+        result.a_node = NULL;
+        result.a_key = NULL;
+        result.a_count = 0;
+    } else if (br.sz < half * 2) {
+        result.a_node = place_branch_range(db,
+                                           &br,
+                                           0,
+                                           br.sz,
+                                           &result.a_count,
+                                           pos,
+                                           root ? AODBM_VERSION_HEADER_SIZE : 0,
+                                           &result.a_pad);
+        result.a_key = aodbm_data_dup(&br.keys[0]);
     } else {
-        result.a_node = branch_to_rope(&a);
-        result.b_node = branch_to_rope(&b);
-        result.a_key = a.key;
-        result.b_key = b.key;
+        result.a_node = place_branch_range(db,
+                                           &br,
+                                           0,
+                                           half,
+                                           &result.a_count,
+                                           pos,
+                                           0,
+                                           &result.a_pad);
+        result.a_key = aodbm_data_dup(&br.keys[0]);
+        pos += result.a_pad + aodbm_rope_size(result.a_node);
+        result.b_node = place_branch_range(db,
+                                           &br,
+                                           half,
+                                           br.sz,
+                                           &result.b_count,
+                                           pos,
+                                           0,
+                                           &result.b_pad);
+        result.b_key = aodbm_data_dup(&br.keys[half]);
+    }
+    
+    free(br.keys);
+    free(br.offs);
+    free(br.counts);
+    aodbm_free_node(old);
+    if (a_key != NULL) {
+        aodbm_free_data(a_key);
+    }
+    if (b_key != NULL) {
+        aodbm_free_data(b_key);
     }
     return result;
 }
@@ -568,51 +944,70 @@ typedef struct {
     uint64_t root;
 } root_result;
 
-root_result construct_root_di(uint64_t prev,
+root_result construct_root_di(aodbm *db,
+                              uint64_t prev,
                               uint64_t append_pos,
                               aodbm_rope *data,
-                              size_t data_sz,
+                              uint64_t data_sz,
                               modify_result nodes) {
     root_result result;
-    aodbm_data *root = aodbm_data_from_64(prev);
+    aodbm_data *root = aodbm_version_header(db, prev);
     
     if (nodes.a_key != NULL) {
         aodbm_free_data(nodes.a_key);
     }
     if (nodes.b_key == NULL) {
+        aodbm_rope *node = nodes.a_node;
+        uint32_t pad = nodes.a_pad;
         if (nodes.a_key == NULL) {
-            aodbm_rope_append_di(data, root);
-            aodbm_rope_append_di(data, aodbm_data_from_str("l"));
-            aodbm_rope_append_di(data, aodbm_data_from_32(0));
-            
-            result.root = append_pos + data_sz;
-        } else {
-            aodbm_rope_prepend_di(root, nodes.a_node);
-            data = aodbm_rope_merge_di(data, nodes.a_node);
-            
-            result.root = data_sz + append_pos;
+            node = aodbm_encode_leaf(db, NULL, NULL, NULL, 0);
+            pad = node_padding(db,
+                               data_sz + append_pos,
+                               AODBM_VERSION_HEADER_SIZE +
+                               aodbm_rope_size(node));
         }
+        aodbm_rope_prepend_di(root, node);
+        result.root = append_node(&data, &data_sz, append_pos, node, pad);
     } else {
-        uint64_t a_sz, b_sz;
         uint64_t a, b;
-        a_sz = aodbm_rope_size(nodes.a_node);
-        a = data_sz + append_pos;
-        data = aodbm_rope_merge_di(data, nodes.a_node);
-        data_sz += a_sz;
-        
-        b_sz = aodbm_rope_size(nodes.b_node);
-        b = data_sz + append_pos;
-        data = aodbm_rope_merge_di(data, nodes.b_node);
-        data_sz += b_sz;
+        a = append_node(&data,
+                        &data_sz,
+                        append_pos,
+                        nodes.a_node,
+                        nodes.a_pad);
+        b = append_node(&data,
+                        &data_sz,
+                        append_pos,
+                        nodes.b_node,
+                        nodes.b_pad);
         
-        /* create a new branch node */
-        aodbm_rope *br = aodbm_branch_di(a, nodes.b_key, b);
+        /* create a new branch node, after its header and any padding */
+        uint64_t pos = data_sz + append_pos;
+        aodbm_rope *br = aodbm_branch_di(db,
+                                         a,
+                                         nodes.a_count,
+                                         aodbm_data_dup(nodes.b_key),
+                                         b,
+                                         nodes.b_count,
+                                         pos + AODBM_VERSION_HEADER_SIZE);
+        uint32_t pad = node_padding(db,
+                                    pos,
+                                    AODBM_VERSION_HEADER_SIZE +
+                                    aodbm_rope_size(br));
+        if (pad != 0) {
+            aodbm_free_rope(br);
+            br = aodbm_branch_di(db,
+                                 a,
+                                 nodes.a_count,
+                                 aodbm_data_dup(nodes.b_key),
+                                 b,
+                                 nodes.b_count,
+                                 pos + pad + AODBM_VERSION_HEADER_SIZE);
+        }
+        aodbm_free_data(nodes.b_key);
         
         aodbm_rope_prepend_di(root, br);
-        
-        result.root = data_sz + append_pos;
-        
-        data = aodbm_rope_merge_di(data, br);
+        result.root = append_node(&data, &data_sz, append_pos, br, pad);
     }
     
     result.dat = aodbm_rope_to_data_di(data);
@@ -624,37 +1019,70 @@ aodbm_version aodbm_set(aodbm *db,
                         aodbm_version ver,
                         aodbm_data *key,
                         aodbm_data *val) {
+    if (db->read_only) {
+        /* 0 is never the result of a set, so it can't be mistaken for one */
+        return 0;
+    }
+    if (db->key_width != 0 && key->sz != db->key_width) {
+        AODBM_CUSTOM_ERROR("error, keys must be the database's key width");
+    }
     /* it has to be locked to prevent the append_pos going astray */
     pthread_mutex_lock(&db->rw);
+    /* a large value is written before the data block, unless it was stored
+       recently */
+    uint64_t ref = 0;
+    if (db->dedup && val->sz >= AODBM_DEDUP_MIN) {
+        ref = aodbm_store_value(db, val);
+    }
     /* find the position of the amendment (filesize + data block header) */
     uint64_t append_pos = aodbm_file_size(db) + 5;
     root_result result;
     
     if (ver == 0) {
-        aodbm_rope *node = aodbm_leaf_node(key, val);
-        aodbm_rope_prepend_di(aodbm_data_from_64(ver), node);
+        aodbm_rope *node = aodbm_leaf_node(db, key, val, ref);
+        aodbm_rope_prepend_di(aodbm_version_header(db, ver), node);
+        aodbm_rope *data = aodbm_rope_empty();
+        uint64_t data_sz = 0;
+        uint32_t pad = node_padding(db, append_pos, aodbm_rope_size(node));
         
-        result.dat = aodbm_rope_to_data_di(node);
-        result.root = append_pos;
+        result.root = append_node(&data, &data_sz, append_pos, node, pad);
+        result.dat = aodbm_rope_to_data_di(data);
     } else {
         char type;
-        aodbm_read(db, ver + 8, 1, &type);
+        aodbm_read(db, ver + AODBM_VERSION_HEADER_SIZE, 1, &type);
         if (type == 'l') {
-            modify_result leaf = insert_into_leaf(db, key, val, ver + 9);
-            result = construct_root_di(ver,
+            modify_result leaf =
+                insert_into_leaf(db,
+                                 NULL,
+                                 key,
+                                 val,
+                                 ref,
+                                 ver + AODBM_VERSION_HEADER_SIZE,
+                                 append_pos,
+                                 true);
+            result = construct_root_di(db,
+                                       ver,
                                        append_pos,
                                        aodbm_rope_empty(),
                                        0,
                                        leaf);
         } else if (type = 'b') {
             aodbm_rope *data = aodbm_rope_empty();
-            uint32_t data_sz = 0;
+            uint64_t data_sz = 0;
             aodbm_stack *path = aodbm_search_path(db, ver, key);
             /* pop the leaf node */
             aodbm_path_node *ptr = aodbm_stack_pop(&path);
             aodbm_path_node node = *ptr;
             free(ptr);
-            modify_result nodes = insert_into_leaf(db, key, val, node.node + 1);
+            modify_result nodes = insert_into_leaf(db,
+                                                   node.key,
+                                                   key,
+                                                   val,
+                                                   ref,
+                                                   node.node,
+                                                   append_pos,
+                                                   false);
+            aodbm_free_data(node.key);
             uint64_t prev_node = node.node;
             
             uint64_t a, b;
@@ -664,18 +1092,19 @@ aodbm_version aodbm_set(aodbm *db,
                 node = *ptr;
                 free(ptr);
                 
-                uint64_t a_sz, b_sz;
-                a_sz = aodbm_rope_size(nodes.a_node);
-                a = data_sz + append_pos;
-                data = aodbm_rope_merge_di(data, nodes.a_node);
-                data_sz += a_sz;
+                a = append_node(&data,
+                                &data_sz,
+                                append_pos,
+                                nodes.a_node,
+                                nodes.a_pad);
                 if (nodes.b_node == NULL) {
                     b = 0;
                 } else {
-                    b_sz = aodbm_rope_size(nodes.b_node);
-                    b = data_sz + append_pos;
-                    data = aodbm_rope_merge_di(data, nodes.b_node);
-                    data_sz += b_sz;
+                    b = append_node(&data,
+                                    &data_sz,
+                                    append_pos,
+                                    nodes.b_node,
+                                    nodes.b_pad);
                 }
                 
                 nodes = modify_branch(db,
@@ -683,16 +1112,21 @@ aodbm_version aodbm_set(aodbm *db,
                                       node.key,
                                       a,
                                       nodes.a_key,
+                                      nodes.a_count,
                                       b,
                                       nodes.b_key,
+                                      nodes.b_count,
                                       prev_node,
-                                      0);
+                                      0,
+                                      data_sz + append_pos,
+                                      path == NULL);
                 aodbm_free_data(node.key);
                 
                 prev_node = node.node;
             }
             
-            result = construct_root_di(ver, append_pos, data, data_sz, nodes);
+            result =
+                construct_root_di(db, ver, append_pos, data, data_sz, nodes);
         } else {
             AODBM_CUSTOM_ERROR("unknown node type");
         }
@@ -701,12 +1135,15 @@ aodbm_version aodbm_set(aodbm *db,
     aodbm_write_data_block(db, result.dat);
     aodbm_free_data(result.dat);
     
-    pthread_mutex_lock(&db->rw);
+    pthread_mutex_unlock(&db->rw);
     
     return result.root;
 }
 
 aodbm_version aodbm_del(aodbm *db, aodbm_version ver, aodbm_data *key) {
+    if (db->read_only) {
+        return 0;
+    }
     if (ver == 0) {
         return 0;
     }
@@ -720,10 +1157,16 @@ aodbm_version aodbm_del(aodbm *db, aodbm_version ver, aodbm_data *key) {
     root_result result;
     
     char type;
-    aodbm_read(db, ver + 8, 1, &type);
+    aodbm_read(db, ver + AODBM_VERSION_HEADER_SIZE, 1, &type);
     if (type == 'l') {
-        modify_result res = remove_from_leaf(db, key, ver + 9);
-        result = construct_root_di(ver, append_pos, aodbm_rope_empty(), 0, res);
+        modify_result res = remove_from_leaf(db,
+                                             NULL,
+                                             key,
+                                             ver + AODBM_VERSION_HEADER_SIZE,
+                                             append_pos,
+                                             true);
+        result =
+            construct_root_di(db, ver, append_pos, aodbm_rope_empty(), 0, res);
     } else if (type == 'b') {
         /* TODO: modify to merge nodes */
         aodbm_rope *data = aodbm_rope_empty();
@@ -734,7 +1177,9 @@ aodbm_version aodbm_del(aodbm *db, aodbm_version ver, aodbm_data *key) {
         aodbm_path_node *ptr = aodbm_stack_pop(&path);
         aodbm_path_node node = *ptr;
         free(ptr);
-        modify_result nodes = remove_from_leaf(db, key, node.node + 1);
+        modify_result nodes =
+            remove_from_leaf(db, node.key, key, node.node, append_pos, false);
+        aodbm_free_data(node.key);
         uint64_t prev_node = node.node;
         
         uint64_t a, b;
@@ -747,20 +1192,20 @@ aodbm_version aodbm_del(aodbm *db, aodbm_version ver, aodbm_data *key) {
             if (nodes.a_key == NULL) {
                 a = 0;
             } else {
-                uint64_t a_sz;
-                a_sz = aodbm_rope_size(nodes.a_node);
-                a = data_sz + append_pos;
-                data = aodbm_rope_merge_di(data, nodes.a_node);
-                data_sz += a_sz;
+                a = append_node(&data,
+                                &data_sz,
+                                append_pos,
+                                nodes.a_node,
+                                nodes.a_pad);
             }
             if (nodes.b_node == NULL) {
                 b = 0;
             } else {
-                uint64_t b_sz;
-                b_sz = aodbm_rope_size(nodes.b_node);
-                b = data_sz + append_pos;
-                data = aodbm_rope_merge_di(data, nodes.b_node);
-                data_sz += b_sz;
+                b = append_node(&data,
+                                &data_sz,
+                                append_pos,
+                                nodes.b_node,
+                                nodes.b_pad);
             }
             
             nodes = modify_branch(db,
@@ -768,16 +1213,20 @@ aodbm_version aodbm_del(aodbm *db, aodbm_version ver, aodbm_data *key) {
                                   node.key,
                                   a,
                                   nodes.a_key,
+                                  nodes.a_count,
                                   b,
                                   nodes.b_key,
+                                  nodes.b_count,
                                   prev_node,
-                                  0);
+                                  0,
+                                  data_sz + append_pos,
+                                  path == NULL);
             aodbm_free_data(node.key);
             
             prev_node = node.node;
         }
         
-        result = construct_root_di(ver, append_pos, data, data_sz, nodes);
+        result = construct_root_di(db, ver, append_pos, data, data_sz, nodes);
     } else {
         AODBM_CUSTOM_ERROR("unknown node type");
     }
@@ -793,53 +1242,191 @@ bool aodbm_has(aodbm *db, aodbm_version ver, aodbm_data *key) {
     if (ver == 0) {
         return false;
     }
-    uint64_t leaf_node = aodbm_search(db, ver, key);
-    uint32_t sz = aodbm_read32(db, leaf_node + 1);
-    uint32_t i;
-    uint64_t pos = leaf_node + 5;
-    for (i = 0; i < sz; ++i) {
-        aodbm_data *r_key = aodbm_read_data(db, pos);
-        pos += r_key->sz + 4;
-        aodbm_data *r_val = aodbm_read_data(db, pos);
-        pos += r_val->sz + 4;
-        
-        bool eq = aodbm_data_eq(key, r_key);
-        
-        aodbm_free_data(r_key);
-        aodbm_free_data(r_val);
-        
-        if (eq) {
-            return true;
-        }
-    }
-    return false;
+    /* the values aren't needed */
+    aodbm_node *leaf = aodbm_read_node(db, aodbm_search(db, ver, key), false);
+    bool result = aodbm_node_find(db, leaf, key) != -1;
+    aodbm_free_node(leaf);
+    return result;
 }
 
 aodbm_data *aodbm_get(aodbm *db, aodbm_version ver, aodbm_data *key) {
     if (ver == 0) {
         return NULL;
     }
-    uint64_t leaf_node = aodbm_search(db, ver, key);
-    uint32_t sz = aodbm_read32(db, leaf_node + 1);
+    aodbm_node *leaf = aodbm_read_node(db, aodbm_search(db, ver, key), true);
+    int64_t i = aodbm_node_find(db, leaf, key);
+    aodbm_data *result = NULL;
+    if (i != -1) {
+        result = aodbm_node_val(db, leaf, i);
+    }
+    aodbm_free_node(leaf);
+    return result;
+}
+
+uint64_t aodbm_rank(aodbm *db, aodbm_version ver, aodbm_data *key) {
+    if (ver == 0) {
+        return 0;
+    }
+    /* add up the records in the children to the left of the path */
+    uint64_t rank = 0;
+    aodbm_node *node =
+        aodbm_read_node(db, ver + AODBM_VERSION_HEADER_SIZE, false);
+    while (node->type == 'b') {
+        uint32_t n = aodbm_node_upper_bound(db, node, key);
+        uint32_t i;
+        for (i = 0; i < n; ++i) {
+            rank += node->counts[i];
+        }
+        uint64_t child = node->offs[n];
+        aodbm_free_node(node);
+        node = aodbm_read_node(db, child, false);
+    }
+    rank += aodbm_node_lower_bound(db, node, key);
+    aodbm_free_node(node);
+    return rank;
+}
+
+uint64_t aodbm_count(aodbm *db,
+                     aodbm_version ver,
+                     aodbm_data *start,
+                     aodbm_data *end) {
+    if (ver == 0) {
+        return 0;
+    }
+    uint64_t hi;
+    if (end == NULL) {
+        aodbm_node *root =
+            aodbm_read_node(db, ver + AODBM_VERSION_HEADER_SIZE, false);
+        hi = aodbm_node_count(root);
+        aodbm_free_node(root);
+    } else {
+        hi = aodbm_rank(db, ver, end);
+    }
+    uint64_t lo = start == NULL ? 0 : aodbm_rank(db, ver, start);
+    return hi > lo ? hi - lo : 0;
+}
+
+typedef struct {
+    aodbm_data *key;
+    size_t idx;
+} get_item;
+
+/* a node and the range of sorted keys that belong in it */
+typedef struct {
+    uint64_t node;
+    size_t begin;
+    size_t end;
+} get_span;
+
+static int get_item_cmp(const void *a, const void *b, void *db) {
+    return aodbm_key_cmp((aodbm *)db,
+                         ((const get_item *)a)->key,
+                         ((const get_item *)b)->key);
+}
+
+static void get_many_leaf(aodbm *db,
+                          aodbm_node *leaf,
+                          get_span span,
+                          get_item *items,
+                          aodbm_data **out) {
+    size_t j = span.begin;
     uint32_t i;
-    uint64_t pos = leaf_node + 5;
-    for (i = 0; i < sz; ++i) {
-        aodbm_data *r_key = aodbm_read_data(db, pos);
-        pos += r_key->sz + 4;
-        aodbm_data *r_val = aodbm_read_data(db, pos);
-        pos += r_val->sz + 4;
-        
-        bool eq = aodbm_data_eq(key, r_key);
-        
-        aodbm_free_data(r_key);
-        
-        if (eq) {
-            return r_val;
+    for (i = 0; i < leaf->sz && j < span.end; ++i) {
+        while (j < span.end && aodbm_key_lt(db, items[j].key, &leaf->keys[i])) {
+            ++j;
+        }
+        while (j < span.end && aodbm_data_eq(items[j].key, &leaf->keys[i])) {
+            out[items[j].idx] = aodbm_node_val(db, leaf, i);
+            ++j;
         }
-        
-        aodbm_free_data(r_val);
     }
-    return NULL;
+}
+
+/* splits the span's keys among the children of a branch, appending the
+   children that have keys to next */
+static void get_many_branch(aodbm *db,
+                            aodbm_node *br,
+                            get_span span,
+                            get_item *items,
+                            get_span *next,
+                            size_t *next_sz) {
+    size_t begin = span.begin;
+    size_t j = span.begin;
+    uint32_t i;
+    for (i = 0; i <= br->sz && begin < span.end; ++i) {
+        if (i == br->sz) {
+            j = span.end;
+        } else {
+            while (j < span.end &&
+                   aodbm_key_lt(db, items[j].key, &br->keys[i])) {
+                ++j;
+            }
+        }
+        if (j > begin) {
+            next[*next_sz].node = br->offs[i];
+            next[*next_sz].begin = begin;
+            next[*next_sz].end = j;
+            *next_sz += 1;
+            begin = j;
+        }
+    }
+}
+
+void aodbm_get_many(aodbm *db,
+                    aodbm_version ver,
+                    aodbm_data **keys,
+                    size_t n,
+                    aodbm_data **out) {
+    size_t i;
+    for (i = 0; i < n; ++i) {
+        out[i] = NULL;
+    }
+    if (ver == 0 || n == 0) {
+        return;
+    }
+    
+    get_item *items = malloc(sizeof(get_item) * n);
+    for (i = 0; i < n; ++i) {
+        items[i].key = keys[i];
+        items[i].idx = i;
+    }
+    qsort_r(items, n, sizeof(get_item), get_item_cmp, db);
+    
+    /*
+      descend a level at a time, every node on a level holds at least one key,
+      so a level never has more than n nodes. the whole level is prefetched
+      before any of it is read, so that the misses overlap
+    */
+    get_span *level = malloc(sizeof(get_span) * n);
+    get_span *next = malloc(sizeof(get_span) * n);
+    size_t level_sz = 1;
+    level[0].node = ver + AODBM_VERSION_HEADER_SIZE;
+    level[0].begin = 0;
+    level[0].end = n;
+    
+    while (level_sz > 0) {
+        for (i = 0; i < level_sz; ++i) {
+            aodbm_prefetch(db, level[i].node);
+        }
+        size_t next_sz = 0;
+        for (i = 0; i < level_sz; ++i) {
+            aodbm_node *node = aodbm_read_node(db, level[i].node, true);
+            if (node->type == 'l') {
+                get_many_leaf(db, node, level[i], items, out);
+            } else {
+                get_many_branch(db, node, level[i], items, next, &next_sz);
+            }
+            aodbm_free_node(node);
+        }
+        get_span *tmp = level;
+        level = next;
+        next = tmp;
+        level_sz = next_sz;
+    }
+    
+    free(level);
+    free(next);
+    free(items);
 }
 
 bool aodbm_is_based_on(aodbm *db, aodbm_version a, aodbm_version b) {
@@ -859,7 +1446,8 @@ bool aodbm_is_based_on(aodbm *db, aodbm_version a, aodbm_version b) {
     if (a == b) {
         return true;
     }
-    return aodbm_is_based_on(db, aodbm_previous_version(db, a), b);
+    uint64_t depth = aodbm_read_version_info(db, b).depth;
+    return aodbm_ancestor_at_depth(db, a, depth) == b;
 }
 
 aodbm_version aodbm_previous_version(aodbm *db, aodbm_version ver) {
@@ -875,246 +1463,1506 @@ aodbm_version aodbm_common_ancestor(aodbm *db,
     if (a == 0 || b == 0) {
         return 0;
     }
-    if (a > b) {
-        return aodbm_common_ancestor(db, aodbm_previous_version(db, a), b);
+    /* bring both versions to the same depth */
+    uint64_t a_depth = aodbm_read_version_info(db, a).depth;
+    uint64_t b_depth = aodbm_read_version_info(db, b).depth;
+    if (a_depth > b_depth) {
+        a = aodbm_ancestor_at_depth(db, a, b_depth);
+    } else {
+        b = aodbm_ancestor_at_depth(db, b, a_depth);
     }
-    if (b > a) {
-        return aodbm_common_ancestor(db, a, aodbm_previous_version(db, b));
+    /* versions of the same depth have jumps of the same depth, so they can be
+       followed in lock step without passing the common ancestor */
+    while (a != b) {
+        aodbm_version_info a_info = aodbm_read_version_info(db, a);
+        aodbm_version_info b_info = aodbm_read_version_info(db, b);
+        if (a_info.jump != b_info.jump) {
+            a = a_info.jump;
+            b = b_info.jump;
+        } else {
+            a = a_info.prev;
+            b = b_info.prev;
+        }
     }
+    return a;
 }
 
 struct aodbm_iterator {
     aodbm_stack *path;
     aodbm_version ver;
+    /* the range of keys to iterate over, start is inclusive and end is
+       exclusive, NULL leaves that side open */
+    aodbm_data *start, *end;
+    /* only keys starting with the prefix are given if it isn't NULL */
+    aodbm_data *prefix;
+    int prefix_mode;
+    /* whether leaves are read with their values. aodbm_iterator_next_key
+       clears this, so that listing keys doesn't read values, the values of a
+       leaf are read when they are first needed */
+    bool vals;
+    /* how many children ahead to read, this grows as the iterator moves
+       from leaf to leaf and drops back to 1 after a goto */
+    uint32_t readahead;
+    /* for each level of the tree, the part of the file that was last read
+       ahead, children inside it aren't hinted again */
+    uint64_t window_start[READAHEAD_LEVELS], window_end[READAHEAD_LEVELS];
 };
 
+/* the keys with a prefix are together in the database's order, so the first
+   key without it ends the iteration */
+#define PREFIX_STOP 0
+/* the keys with a prefix may be anywhere, so the other keys are skipped */
+#define PREFIX_SKIP 1
+
+/* what an iterator does with a record */
+#define RECORD_GIVE 0
+#define RECORD_SKIP 1
+#define RECORD_STOP 2
+
+/* n is the next record of a leaf or the current child of a branch. For a
+   branch, the children from hinted_back up to hinted have already been read
+   ahead. depth is 0 for the root. The keys under the node are from lo
+   (inclusive) to hi (exclusive), NULL if that side is open, these point into
+   the keys of the node's ancestors */
 typedef struct {
-    uint64_t pos;
+    aodbm_node *node;
     uint32_t n;
-    uint32_t sz;
+    uint32_t hinted, hinted_back;
+    uint32_t depth;
+    aodbm_data *lo, *hi;
 } it_node_info;
 
-void construct_iterator(aodbm *db, aodbm_iterator *it, uint64_t node) {
-    char type;
-    aodbm_read(db, node, 1, &type);
-    
-    uint32_t size = aodbm_read32(db, node + 1);
-    
+static void free_it_node_info(it_node_info *info) {
+    aodbm_free_node(info->node);
+    free(info);
+}
+
+/* pushes the current child of parent, or the root if parent is NULL */
+static it_node_info *push_it_node(aodbm *db,
+                                  aodbm_iterator *it,
+                                  it_node_info *parent) {
     it_node_info *info = malloc(sizeof(it_node_info));
-    info->sz = size;
+    if (parent == NULL) {
+        info->node = aodbm_read_node(db,
+                                     it->ver + AODBM_VERSION_HEADER_SIZE,
+                                     it->vals);
+        info->depth = 0;
+        info->lo = NULL;
+        info->hi = NULL;
+    } else {
+        uint32_t n = parent->n;
+        info->node = aodbm_read_node(db, parent->node->offs[n], it->vals);
+        info->depth = parent->depth + 1;
+        info->lo = n == 0 ? parent->lo : &parent->node->keys[n - 1];
+        info->hi = n == parent->node->sz ? parent->hi : &parent->node->keys[n];
+    }
     info->n = 0;
-    
-    if (type == 'l') {
-        info->pos = node + 5;
-        aodbm_stack_push(&it->path, info);
-    } else if (type == 'b') {
-        uint64_t n = aodbm_read64(db, node + 5);
-        
-        info->pos = node + 13;
-        aodbm_stack_push(&it->path, info);
-        
-        construct_iterator(db, it, n);
+    info->hinted = 0;
+    info->hinted_back = info->node->sz + 1;
+    aodbm_stack_push(&it->path, info);
+    return info;
+}
+
+/* whether the key belongs under the node */
+static bool it_node_covers(aodbm *db, it_node_info *info, aodbm_data *key) {
+    return (info->lo == NULL || aodbm_key_le(db, info->lo, key)) &&
+           (info->hi == NULL || aodbm_key_lt(db, key, info->hi));
+}
+
+/* whether every key in a branch's child i is at or past the end of the
+   iterator's range */
+static bool child_after_range(aodbm *db,
+                              aodbm_iterator *it,
+                              aodbm_node *node,
+                              uint32_t i) {
+    return i > 0 &&
+           it->end != NULL &&
+           aodbm_key_le(db, it->end, &node->keys[i - 1]);
+}
+
+/* whether every key in a branch's child i is before the start of the
+   iterator's range */
+static bool child_before_range(aodbm *db,
+                               aodbm_iterator *it,
+                               aodbm_node *node,
+                               uint32_t i) {
+    return i < node->sz &&
+           it->start != NULL &&
+           aodbm_key_le(db, &node->keys[i], it->start);
+}
+
+static void hint_node(aodbm *db,
+                      aodbm_iterator *it,
+                      uint32_t depth,
+                      uint64_t off,
+                      bool back) {
+    uint64_t *start = &it->window_start[depth];
+    uint64_t *stop = &it->window_end[depth];
+    if (off >= *start && off < *stop) {
+        return;
+    }
+    /* nodes written together are near each other, so read a run of the file
+       in one go */
+    uint64_t span = (uint64_t)it->readahead * READAHEAD_SPAN;
+    if (back) {
+        *start = off + READAHEAD_SPAN > span ? off + READAHEAD_SPAN - span : 0;
+        *stop = off + READAHEAD_SPAN;
     } else {
-        AODBM_CUSTOM_ERROR("unknown node type");
+        *start = off;
+        *stop = off + span;
     }
+    aodbm_readahead(db, *start, *stop - *start);
 }
 
-aodbm_iterator *aodbm_new_iterator(aodbm *db, aodbm_version ver) {
-    /* create the path of the first record */
+/* starts reading the children that follow a branch's current child */
+static void it_readahead(aodbm *db, aodbm_iterator *it, it_node_info *info) {
+    uint32_t end = info->n + 1 + it->readahead;
+    if (end > info->node->sz + 1) {
+        end = info->node->sz + 1;
+    }
+    if (info->hinted < info->n + 1) {
+        info->hinted = info->n + 1;
+    }
+    if (info->depth >= READAHEAD_LEVELS) {
+        return;
+    }
+    for (; info->hinted < end; ++info->hinted) {
+        if (child_after_range(db, it, info->node, info->hinted)) {
+            break;
+        }
+        hint_node(db, it, info->depth, info->node->offs[info->hinted], false);
+    }
+}
+
+/* starts reading the children that precede a branch's current child */
+static void it_readahead_back(aodbm *db,
+                              aodbm_iterator *it,
+                              it_node_info *info) {
+    uint32_t begin = info->n > it->readahead ? info->n - it->readahead : 0;
+    if (info->hinted_back > info->n) {
+        info->hinted_back = info->n;
+    }
+    if (info->depth >= READAHEAD_LEVELS) {
+        return;
+    }
+    while (info->hinted_back > begin) {
+        if (child_before_range(db, it, info->node, info->hinted_back - 1)) {
+            break;
+        }
+        info->hinted_back -= 1;
+        hint_node(db, it, info->depth, info->node->offs[info->hinted_back], true);
+    }
+}
+
+static void reset_readahead(aodbm_iterator *it) {
+    it->readahead = 1;
+    memset(it->window_start, 0, sizeof(it->window_start));
+    memset(it->window_end, 0, sizeof(it->window_end));
+}
+
+/* pushes the path to the first record under the current child of parent, or
+   under the root if parent is NULL */
+static void construct_iterator(aodbm *db,
+                               aodbm_iterator *it,
+                               it_node_info *parent) {
+    it_node_info *info = push_it_node(db, it, parent);
+    while (info->node->type == 'b') {
+        it_readahead(db, it, info);
+        info = push_it_node(db, it, info);
+    }
+}
+
+/* like construct_iterator, but to the position after the last record */
+static void construct_iterator_back(aodbm *db,
+                                    aodbm_iterator *it,
+                                    it_node_info *parent) {
+    it_node_info *info = push_it_node(db, it, parent);
+    while (info->node->type == 'b') {
+        info->n = info->node->sz;
+        it_readahead_back(db, it, info);
+        info = push_it_node(db, it, info);
+    }
+    info->n = info->node->sz;
+}
+
+static aodbm_iterator *alloc_iterator(aodbm_version ver,
+                                      aodbm_data *start,
+                                      aodbm_data *end) {
     aodbm_iterator *it = malloc(sizeof(aodbm_iterator));
     it->path = NULL;
     it->ver = ver;
+    it->start = start == NULL ? NULL : aodbm_data_dup(start);
+    it->end = end == NULL ? NULL : aodbm_data_dup(end);
+    it->prefix = NULL;
+    it->prefix_mode = PREFIX_STOP;
+    it->vals = true;
+    reset_readahead(it);
+    return it;
+}
+
+aodbm_iterator *aodbm_new_iterator(aodbm *db, aodbm_version ver) {
+    /* create the path of the first record */
+    aodbm_iterator *it = alloc_iterator(ver, NULL, NULL);
     
     if (ver != 0) {
-        construct_iterator(db, it, ver + 8);
+        construct_iterator(db, it, NULL);
     }
     
     return it;
 }
 
-void aodbm_iterator_goto_recursive(aodbm *db,
-                                   aodbm_iterator *it,
-                                   aodbm_data *key,
-                                   uint64_t node) {
-    char type;
-    aodbm_read(db, node, 1, &type);
-    
-    uint32_t size = aodbm_read32(db, node + 1);
-    
-    it_node_info *info = malloc(sizeof(it_node_info));
-    info->sz = size;
-    
-    uint32_t n;
-    uint64_t pos = node + 5;
-    
-    if (type == 'l') {
-        for (n = 0; n < size; ++n) {
-            aodbm_data *s_key = aodbm_read_data(db, pos);
-            
-            if (aodbm_data_le(key, s_key)) {
-                aodbm_free_data(s_key);
-                break;
-            }
-            
-            pos += 4 + s_key->sz;
-            aodbm_free_data(s_key);
-            aodbm_data *s_val = aodbm_read_data(db, pos);
-            pos += 4 + s_val->sz;
-            aodbm_free_data(s_val);
-        }
-        
-        info->pos = pos;
-        info->n = n;
-        aodbm_stack_push(&it->path, info);
-    } else if (type == 'b') {
-        uint64_t off = aodbm_read64(db, pos);
-        pos += 8;
-        
-        for (n = 0; n < size; ++n) {
-            aodbm_data *s_key = aodbm_read_data(db, pos);
-            
-            if (aodbm_data_lt(key, s_key)) {
-                aodbm_free_data(s_key);
-                break;
-            }
-            
-            pos += 4 + s_key->sz;        
-            aodbm_free_data(s_key);
-            off = aodbm_read64(db, pos);
-            pos += 8;
-        }
-        
-        info->pos = pos;
-        info->n = n;
-        aodbm_stack_push(&it->path, info);
-        
-        aodbm_iterator_goto_recursive(db, it, key, off);
-    } else {
-        AODBM_CUSTOM_ERROR("unknown node type");
+static void clear_iterator(aodbm_iterator *it) {
+    while (it->path != NULL) {
+        free_it_node_info(aodbm_stack_pop(&it->path));
     }
 }
 
 void aodbm_iterator_goto(aodbm *db,
                          aodbm_iterator *it,
                          aodbm_data *key) {
+    /* climb to the lowest node that the key belongs under, so that a short
+       seek only reads the nodes between the old and new positions */
+    it_node_info *info = NULL;
     while (it->path != NULL) {
-        free(aodbm_stack_pop(&it->path));
+        info = aodbm_stack_pop(&it->path);
+        if (it_node_covers(db, info, key)) {
+            break;
+        }
+        free_it_node_info(info);
+        info = NULL;
+    }
+    if (info == NULL) {
+        reset_readahead(it);
+        if (it->ver == 0) {
+            return;
+        }
+        info = push_it_node(db, it, NULL);
+    } else {
+        aodbm_stack_push(&it->path, info);
+        if (info->node->type == 'b') {
+            /* the iterator is moving to another leaf */
+            it->readahead = 1;
+        }
     }
-    aodbm_iterator_goto_recursive(db, it, key, it->ver + 8);
+    
+    while (info->node->type == 'b') {
+        info->n = aodbm_node_upper_bound(db, info->node, key);
+        it_readahead(db, it, info);
+        info = push_it_node(db, it, info);
+    }
+    info->n = aodbm_node_lower_bound(db, info->node, key);
 }
 
 aodbm_iterator *aodbm_iterate_from(aodbm *db,
                                    aodbm_version ver,
                                    aodbm_data *key) {
-    aodbm_iterator *it = malloc(sizeof(aodbm_iterator));
-    it->path = NULL;
-    it->ver = ver;
+    aodbm_iterator *it = alloc_iterator(ver, NULL, NULL);
     
     aodbm_iterator_goto(db, it, key);
     
     return it;
 }
 
-void aodbm_free_iterator(aodbm_iterator *it) {
-    while (it->path != NULL) {
-        free(aodbm_stack_pop(&it->path));
+aodbm_iterator *aodbm_iterate_range(aodbm *db,
+                                    aodbm_version ver,
+                                    aodbm_data *start,
+                                    aodbm_data *end,
+                                    bool reverse) {
+    aodbm_iterator *it = alloc_iterator(ver, start, end);
+    
+    if (reverse && end != NULL) {
+        aodbm_iterator_goto(db, it, end);
+    } else if (!reverse && start != NULL) {
+        aodbm_iterator_goto(db, it, start);
+    } else if (ver != 0) {
+        if (reverse) {
+            construct_iterator_back(db, it, NULL);
+        } else {
+            construct_iterator(db, it, NULL);
+        }
     }
-    free(it);
+    
+    return it;
 }
 
-aodbm_record aodbm_iterator_next(aodbm *db, aodbm_iterator *it) {
-    aodbm_record output;
-    
-    if (it->path == NULL) {
-        output.key = NULL;
-        output.val = NULL;
-        return output;
+aodbm_iterator *aodbm_iterate_reverse_from(aodbm *db,
+                                           aodbm_version ver,
+                                           aodbm_data *key) {
+    return aodbm_iterate_range(db, ver, NULL, key, true);
+}
+
+aodbm_iterator *aodbm_iterate_from_index(aodbm *db,
+                                         aodbm_version ver,
+                                         uint64_t index) {
+    aodbm_iterator *it = alloc_iterator(ver, NULL, NULL);
+    if (ver == 0) {
+        return it;
     }
     
-    it_node_info *leaf = aodbm_stack_pop(&it->path);
-    
-    if (leaf->n == leaf->sz) {
-        /* advance to the next leaf node */
-        while (it->path != NULL) {
-            it_node_info *branch = aodbm_stack_pop(&it->path);
-            
-            if (branch->n < branch->sz) {
-                /* advance the branch and construct the stack */
-                aodbm_data *key = aodbm_read_data(db, branch->pos);
-                branch->pos += 4 + key->sz;
-                aodbm_free_data(key);
-                
-                uint64_t node = aodbm_read64(db, branch->pos);
-                branch->pos += 8;
-                
-                branch->n += 1;
-                
-                aodbm_stack_push(&it->path, branch);
-                
-                /* travel back down the stack */
-                construct_iterator(db, it, node);
-                
-                free(leaf);
-                leaf = aodbm_stack_pop(&it->path);
-                break;
-            }
-            
-            free(branch);
-        }
-        if (it->path == NULL) {
-            output.key = NULL;
-            output.val = NULL;
-            return output;
+    /* follow the counts down to the leaf with the record */
+    it_node_info *info = push_it_node(db, it, NULL);
+    while (info->node->type == 'b') {
+        uint32_t n = 0;
+        while (n < info->node->sz && index >= info->node->counts[n]) {
+            index -= info->node->counts[n];
+            n += 1;
         }
+        info->n = n;
+        it_readahead(db, it, info);
+        info = push_it_node(db, it, info);
     }
+    /* past the end, the iterator is left after the last record */
+    info->n = index < info->node->sz ? index : info->node->sz;
     
-    output.key = aodbm_read_data(db, leaf->pos);
-    leaf->pos += 4 + output.key->sz;
-    output.val = aodbm_read_data(db, leaf->pos);
-    leaf->pos += 4 + output.val->sz;
-    leaf->n += 1;
-    
-    aodbm_stack_push(&it->path, leaf);
-    
-    return output;
+    return it;
 }
 
-/* Find the changeset that you would apply to the prev to get to ver */
-aodbm_changeset aodbm_diff_prev(aodbm *db, aodbm_version ver) {
-    assert(0);
+/* the first key after every key starting with the prefix in lexicographic
+   order, or NULL if there isn't one */
+static aodbm_data *prefix_successor(aodbm_data *prefix) {
+    size_t sz = prefix->sz;
+    while (sz > 0 && (unsigned char)prefix->dat[sz - 1] == 0xff) {
+        sz -= 1;
+    }
+    if (sz == 0) {
+        return NULL;
+    }
+    aodbm_data *out = aodbm_construct_data(prefix->dat, sz);
+    out->dat[sz - 1] += 1;
+    return out;
 }
 
-/* Find the changeset that you would apply to ver to get to the prev */
-aodbm_changeset aodbm_diff_prev_rev(aodbm *db, aodbm_version ver) {
-    assert(0);
+/* the lowest key of the database's width that starts with the prefix, in one
+   of the built in orders */
+static aodbm_data *prefix_lowest(aodbm *db, aodbm_data *prefix) {
+    aodbm_data *out = malloc(sizeof(aodbm_data));
+    out->sz = db->key_width;
+    out->dat = malloc(out->sz);
+    memcpy(out->dat, prefix->dat, prefix->sz);
+    size_t i;
+    for (i = prefix->sz; i < out->sz; ++i) {
+        if (db->order == AODBM_ORDER_DEFAULT) {
+            /* the bytes are signed */
+            out->dat[i] = (char)0x80;
+        } else if (db->order == AODBM_ORDER_I64 && i == 0) {
+            /* the most negative number */
+            out->dat[i] = (char)0x80;
+        } else {
+            out->dat[i] = 0;
+        }
+    }
+    return out;
 }
 
-/* Find the changeset that you would apply to go from a to b */
-aodbm_changeset aodbm_diff(aodbm *db, aodbm_version a, aodbm_version b) {
-    aodbm_version c = aodbm_common_ancestor(db, a, b);
-    if (c != a && c != b) {
-        aodbm_changeset cb = aodbm_diff(db, c, b);
-        aodbm_changeset ac = aodbm_diff(db, a, c);
-        return aodbm_changeset_merge_di(ac, cb);
+aodbm_iterator *aodbm_iterate_prefix(aodbm *db,
+                                     aodbm_version ver,
+                                     aodbm_data *prefix) {
+    aodbm_data *start = NULL, *end = NULL;
+    int mode = PREFIX_STOP;
+    if (db->order == AODBM_ORDER_LEX) {
+        /* seek to the prefix and don't read past the last key with it */
+        start = aodbm_data_dup(prefix);
+        end = prefix_successor(prefix);
+    } else if (db->key_width != 0 && db->order != AODBM_ORDER_CUSTOM) {
+        /* keys with the same width and prefix are together in every built in
+           order */
+        if (prefix->sz > db->key_width) {
+            return alloc_iterator(0, NULL, NULL);
+        }
+        start = prefix_lowest(db, prefix);
+    } else {
+        /* shorter keys come first, so the keys with the prefix are spread
+           through the database */
+        mode = PREFIX_SKIP;
     }
-    aodbm_changeset res;
     
-    if (a < b) {
-        while (b != a) {
-            res = aodbm_changeset_merge_di(res, aodbm_diff_prev(db, b));
-            b = aodbm_previous_version(db, b);
-        }
-    } else if (b < a) {
-        while (a != b) {
-            res = aodbm_changeset_merge_di(res, aodbm_diff_prev_rev(db, a));
-            a = aodbm_previous_version(db, a);
+    aodbm_iterator *it = aodbm_iterate_range(db, ver, start, end, false);
+    it->prefix = aodbm_data_dup(prefix);
+    it->prefix_mode = mode;
+    if (start != NULL) {
+        aodbm_free_data(start);
+    }
+    if (end != NULL) {
+        aodbm_free_data(end);
+    }
+    return it;
+}
+
+/* the key of the record with the given index, which must exist */
+static aodbm_data *key_at_index(aodbm *db,
+                                aodbm_version ver,
+                                uint64_t index) {
+    aodbm_node *node =
+        aodbm_read_node(db, ver + AODBM_VERSION_HEADER_SIZE, false);
+    while (node->type == 'b') {
+        uint32_t n = 0;
+        while (n < node->sz && index >= node->counts[n]) {
+            index -= node->counts[n];
+            n += 1;
         }
+        uint64_t child = node->offs[n];
+        aodbm_free_node(node);
+        node = aodbm_read_node(db, child, false);
+    }
+    aodbm_data *key = aodbm_data_dup(&node->keys[index]);
+    aodbm_free_node(node);
+    return key;
+}
+
+size_t aodbm_partition(aodbm *db,
+                       aodbm_version ver,
+                       aodbm_data *start,
+                       aodbm_data *end,
+                       size_t n,
+                       aodbm_iterator **its) {
+    uint64_t total = aodbm_count(db, ver, start, end);
+    if (total == 0 || n == 0) {
+        return 0;
+    }
+    if (n > total) {
+        n = total;
     }
+    uint64_t base = start == NULL ? 0 : aodbm_rank(db, ver, start);
     
-    return res;
+    /* each range starts at the key of the record that its share of the
+       records begins at */
+    aodbm_data *lo = start;
+    size_t i;
+    for (i = 0; i < n; ++i) {
+        aodbm_data *hi = end;
+        if (i + 1 < n) {
+            hi = key_at_index(db, ver, base + total * (i + 1) / n);
+        }
+        its[i] = aodbm_iterate_range(db, ver, lo, hi, false);
+        if (lo != start) {
+            aodbm_free_data(lo);
+        }
+        lo = hi;
+    }
+    return n;
 }
 
-aodbm_version aodbm_apply(aodbm *db, aodbm_version ver, aodbm_changeset ch) {
+typedef struct {
+    aodbm *db;
+    aodbm_iterator *it;
+    size_t part;
+    aodbm_scan_fn fn;
+    void *ctx;
+} scan_job;
+
+static void *scan_thread(void *ptr) {
+    scan_job *job = ptr;
+    aodbm_record rec;
+    while ((rec = aodbm_iterator_next(job->db, job->it)).key != NULL) {
+        job->fn(job->part, rec.key, rec.val, job->ctx);
+        aodbm_free_data(rec.key);
+        aodbm_free_data(rec.val);
+    }
+    return NULL;
+}
+
+void aodbm_parallel_scan(aodbm *db,
+                         aodbm_version ver,
+                         aodbm_data *start,
+                         aodbm_data *end,
+                         size_t n,
+                         aodbm_scan_fn fn,
+                         void *ctx) {
+    aodbm_iterator **its = malloc(sizeof(aodbm_iterator *) * n);
+    n = aodbm_partition(db, ver, start, end, n, its);
+    scan_job *jobs = malloc(sizeof(scan_job) * n);
+    pthread_t *threads = malloc(sizeof(pthread_t) * n);
+    size_t i;
+    for (i = 0; i < n; ++i) {
+        jobs[i].db = db;
+        jobs[i].it = its[i];
+        jobs[i].part = i;
+        jobs[i].fn = fn;
+        jobs[i].ctx = ctx;
+        if (pthread_create(&threads[i], NULL, scan_thread, &jobs[i]) != 0) {
+            AODBM_OS_ERROR();
+        }
+    }
+    for (i = 0; i < n; ++i) {
+        pthread_join(threads[i], NULL);
+        aodbm_free_iterator(its[i]);
+    }
+    free(threads);
+    free(jobs);
+    free(its);
+}
+
+void aodbm_free_iterator(aodbm_iterator *it) {
+    clear_iterator(it);
+    if (it->start != NULL) {
+        aodbm_free_data(it->start);
+    }
+    if (it->end != NULL) {
+        aodbm_free_data(it->end);
+    }
+    if (it->prefix != NULL) {
+        aodbm_free_data(it->prefix);
+    }
+    free(it);
+}
+
+/* puts back the nodes popped while looking for a neighbouring leaf, so that
+   the iterator stays where it was */
+static void restore_path(aodbm_iterator *it, aodbm_stack **popped) {
+    while (*popped != NULL) {
+        aodbm_stack_push(&it->path, aodbm_stack_pop(popped));
+    }
+}
+
+static void free_popped(aodbm_stack **popped) {
+    while (*popped != NULL) {
+        free_it_node_info(aodbm_stack_pop(popped));
+    }
+}
+
+/* pops the leaf with the iterator's next record, moving on to the next leaf
+   if the current one is used up. Returns NULL, leaving the iterator where it
+   is, at the end of the tree or the range */
+static it_node_info *pop_it_leaf(aodbm *db, aodbm_iterator *it) {
+    if (it->path == NULL) {
+        return NULL;
+    }
+    
+    it_node_info *leaf = aodbm_stack_pop(&it->path);
+    
+    if (leaf->n < leaf->node->sz) {
+        return leaf;
+    }
+    
+    /* advance to the next leaf node */
+    aodbm_stack *popped = NULL;
+    aodbm_stack_push(&popped, leaf);
+    while (it->path != NULL) {
+        it_node_info *branch = aodbm_stack_pop(&it->path);
+        
+        if (branch->n < branch->node->sz) {
+            if (child_after_range(db, it, branch->node, branch->n + 1)) {
+                /* don't read leaves that can't be in the range */
+                aodbm_stack_push(&it->path, branch);
+                break;
+            }
+            free_popped(&popped);
+            /* advance the branch and travel back down, reading further
+               ahead the longer the scan goes on */
+            if (it->readahead < MAX_READAHEAD) {
+                it->readahead *= 2;
+            }
+            branch->n += 1;
+            it_readahead(db, it, branch);
+            aodbm_stack_push(&it->path, branch);
+            construct_iterator(db, it, branch);
+            
+            return aodbm_stack_pop(&it->path);
+        }
+        
+        aodbm_stack_push(&popped, branch);
+    }
+    
+    restore_path(it, &popped);
+    return NULL;
+}
+
+/* like pop_it_leaf, but for the leaf with the iterator's previous record */
+static it_node_info *pop_it_leaf_back(aodbm *db, aodbm_iterator *it) {
+    if (it->path == NULL) {
+        return NULL;
+    }
+    
+    it_node_info *leaf = aodbm_stack_pop(&it->path);
+    
+    if (leaf->n > 0) {
+        return leaf;
+    }
+    
+    /* move back to the previous leaf node */
+    aodbm_stack *popped = NULL;
+    aodbm_stack_push(&popped, leaf);
+    while (it->path != NULL) {
+        it_node_info *branch = aodbm_stack_pop(&it->path);
+        
+        if (branch->n > 0) {
+            if (child_before_range(db, it, branch->node, branch->n - 1)) {
+                aodbm_stack_push(&it->path, branch);
+                break;
+            }
+            free_popped(&popped);
+            if (it->readahead < MAX_READAHEAD) {
+                it->readahead *= 2;
+            }
+            branch->n -= 1;
+            it_readahead_back(db, it, branch);
+            aodbm_stack_push(&it->path, branch);
+            construct_iterator_back(db, it, branch);
+            
+            return aodbm_stack_pop(&it->path);
+        }
+        
+        aodbm_stack_push(&popped, branch);
+    }
+    
+    restore_path(it, &popped);
+    return NULL;
+}
+
+/* whether the iterator gives, skips or stops at a key, going forwards or
+   backwards */
+static int check_record(aodbm *db,
+                        aodbm_iterator *it,
+                        aodbm_data *key,
+                        bool forward) {
+    if (forward && it->end != NULL && aodbm_key_le(db, it->end, key)) {
+        return RECORD_STOP;
+    }
+    if (!forward && it->start != NULL && aodbm_key_lt(db, key, it->start)) {
+        return RECORD_STOP;
+    }
+    if (it->prefix != NULL &&
+        (key->sz < it->prefix->sz ||
+         memcmp(key->dat, it->prefix->dat, it->prefix->sz) != 0)) {
+        return it->prefix_mode == PREFIX_STOP ? RECORD_STOP : RECORD_SKIP;
+    }
+    return RECORD_GIVE;
+}
+
+aodbm_record aodbm_iterator_next(aodbm *db, aodbm_iterator *it) {
+    aodbm_record output;
+    output.key = NULL;
+    output.val = NULL;
+    
+    it->vals = true;
+    it_node_info *leaf;
+    while ((leaf = pop_it_leaf(db, it)) != NULL) {
+        aodbm_data *key = &leaf->node->keys[leaf->n];
+        int state = check_record(db, it, key, true);
+        if (state == RECORD_GIVE) {
+            aodbm_node_read_vals(db, leaf->node);
+            output.key = aodbm_data_dup(key);
+            output.val = aodbm_node_val(db, leaf->node, leaf->n);
+        }
+        if (state != RECORD_STOP) {
+            leaf->n += 1;
+        }
+        aodbm_stack_push(&it->path, leaf);
+        if (state != RECORD_SKIP) {
+            break;
+        }
+    }
+    
+    return output;
+}
+
+aodbm_data *aodbm_iterator_next_key(aodbm *db, aodbm_iterator *it) {
+    aodbm_data *output = NULL;
+    
+    it->vals = false;
+    it_node_info *leaf;
+    while ((leaf = pop_it_leaf(db, it)) != NULL) {
+        aodbm_data *key = &leaf->node->keys[leaf->n];
+        int state = check_record(db, it, key, true);
+        if (state == RECORD_GIVE) {
+            output = aodbm_data_dup(key);
+        }
+        if (state != RECORD_STOP) {
+            leaf->n += 1;
+        }
+        aodbm_stack_push(&it->path, leaf);
+        if (state != RECORD_SKIP) {
+            break;
+        }
+    }
+    
+    return output;
+}
+
+aodbm_record aodbm_iterator_prev(aodbm *db, aodbm_iterator *it) {
+    aodbm_record output;
+    output.key = NULL;
+    output.val = NULL;
+    
+    it->vals = true;
+    it_node_info *leaf;
+    while ((leaf = pop_it_leaf_back(db, it)) != NULL) {
+        aodbm_data *key = &leaf->node->keys[leaf->n - 1];
+        int state = check_record(db, it, key, false);
+        if (state == RECORD_GIVE) {
+            aodbm_node_read_vals(db, leaf->node);
+            output.key = aodbm_data_dup(key);
+            output.val = aodbm_node_val(db, leaf->node, leaf->n - 1);
+        }
+        if (state != RECORD_STOP) {
+            leaf->n -= 1;
+        }
+        aodbm_stack_push(&it->path, leaf);
+        if (state != RECORD_SKIP) {
+            break;
+        }
+    }
+    
+    return output;
+}
+
+aodbm_data *aodbm_iterator_prev_key(aodbm *db, aodbm_iterator *it) {
+    aodbm_data *output = NULL;
+    
+    it->vals = false;
+    it_node_info *leaf;
+    while ((leaf = pop_it_leaf_back(db, it)) != NULL) {
+        aodbm_data *key = &leaf->node->keys[leaf->n - 1];
+        int state = check_record(db, it, key, false);
+        if (state == RECORD_GIVE) {
+            output = aodbm_data_dup(key);
+        }
+        if (state != RECORD_STOP) {
+            leaf->n -= 1;
+        }
+        aodbm_stack_push(&it->path, leaf);
+        if (state != RECORD_SKIP) {
+            break;
+        }
+    }
+    
+    return output;
+}
+
+static size_t batch_record_size(aodbm_data *key, aodbm_data *val) {
+    return 2 * sizeof(uint32_t) + key->sz + val->sz;
+}
+
+size_t aodbm_iterator_next_batch(aodbm *db,
+                                 aodbm_iterator *it,
+                                 char *buf,
+                                 size_t buf_size,
+                                 size_t *count) {
+    size_t used = 0;
+    *count = 0;
+    
+    it->vals = true;
+    it_node_info *leaf;
+    while ((leaf = pop_it_leaf(db, it)) != NULL) {
+        aodbm_node_read_vals(db, leaf->node);
+        /* copy out as much of this leaf as fits */
+        while (leaf->n < leaf->node->sz) {
+            aodbm_data *key = &leaf->node->keys[leaf->n];
+            aodbm_data *val = &leaf->node->vals[leaf->n];
+            int state = check_record(db, it, key, true);
+            if (state == RECORD_STOP) {
+                aodbm_stack_push(&it->path, leaf);
+                return used;
+            } else if (state == RECORD_SKIP) {
+                leaf->n += 1;
+                continue;
+            }
+            size_t sz = batch_record_size(key, val);
+            if (used + sz > buf_size) {
+                aodbm_stack_push(&it->path, leaf);
+                /* nothing fits, tell the caller how much room it needs */
+                return *count == 0 ? sz : used;
+            }
+            uint32_t key_sz = key->sz, val_sz = val->sz;
+            memcpy(buf + used, &key_sz, sizeof(uint32_t));
+            memcpy(buf + used + sizeof(uint32_t), &val_sz, sizeof(uint32_t));
+            memcpy(buf + used + 2 * sizeof(uint32_t), key->dat, key->sz);
+            aodbm_node_copy_val(db,
+                                leaf->node,
+                                leaf->n,
+                                buf + used + 2 * sizeof(uint32_t) + key->sz);
+            used += sz;
+            *count += 1;
+            leaf->n += 1;
+        }
+        aodbm_stack_push(&it->path, leaf);
+    }
+    
+    return used;
+}
+
+/* the number of places that records are taken from for a dictionary */
+#define DICT_SAMPLES 64
+
+void aodbm_train_dictionary(aodbm *db, aodbm_version ver) {
+    if (db->read_only) {
+        return;
+    }
+    #ifndef AODBM_USE_ZLIB
+    AODBM_CUSTOM_ERROR("error, aodbm was built without compression");
+    #endif
+    if (db->dicts_sz == AODBM_MAX_DICTS) {
+        AODBM_CUSTOM_ERROR("error, too many compression dictionaries");
+    }
+    /* records from evenly spaced places in the version, each given an equal
+       share of the dictionary */
+    uint64_t n = aodbm_count(db, ver, NULL, NULL);
+    uint64_t samples = n < DICT_SAMPLES ? n : DICT_SAMPLES;
+    if (samples == 0) {
+        return;
+    }
+    size_t share = AODBM_DICT_SIZE / samples;
+    aodbm_data *dict = malloc(sizeof(aodbm_data));
+    dict->dat = malloc(AODBM_DICT_SIZE);
+    dict->sz = 0;
+    uint64_t i;
+    for (i = 0; i < samples; ++i) {
+        aodbm_iterator *it = aodbm_iterate_from_index(db, ver, i * n / samples);
+        aodbm_record rec = aodbm_iterator_next(db, it);
+        aodbm_data *parts[2] = {rec.key, rec.val};
+        size_t used = 0;
+        int j;
+        for (j = 0; j < 2; ++j) {
+            size_t sz = parts[j]->sz;
+            if (sz > share - used) {
+                sz = share - used;
+            }
+            memcpy(dict->dat + dict->sz, parts[j]->dat, sz);
+            dict->sz += sz;
+            used += sz;
+            aodbm_free_data(parts[j]);
+        }
+        aodbm_free_iterator(it);
+    }
+    aodbm_write_dict_block(db, dict);
+    aodbm_free_data(dict);
+}
+
+void aodbm_align_nodes(aodbm *db, uint32_t align) {
+    /* the positions of nodes are worked out with the rw mutex held */
+    pthread_mutex_lock(&db->rw);
+    db->node_align = align;
+    pthread_mutex_unlock(&db->rw);
+}
+
+/* the most bytes that aodbm_repack puts in one data block */
+#define REPACK_BLOCK_SIZE (1 << 24)
+
+/* the nodes of one level of a tree that is built from the bottom up, keys[i]
+   is the lower bound of the ith node */
+typedef struct {
+    aodbm_data *keys;
+    uint64_t *offs;
+    uint64_t *counts;
+    uint64_t sz;
+} packed_level;
+
+static packed_level new_packed_level(uint64_t sz) {
+    packed_level lvl;
+    lvl.keys = malloc(sizeof(aodbm_data) * sz);
+    lvl.offs = malloc(sizeof(uint64_t) * sz);
+    lvl.counts = malloc(sizeof(uint64_t) * sz);
+    lvl.sz = 0;
+    return lvl;
+}
+
+static void free_packed_level(packed_level *lvl) {
+    free(lvl->keys);
+    free(lvl->offs);
+    free(lvl->counts);
+}
+
+/* the data block that a repacked tree is being written into */
+typedef struct {
+    aodbm *db;
+    aodbm_rope *data;
+    uint64_t data_sz;
+    uint64_t append_pos;
+} packed_block;
+
+static void start_packed_block(packed_block *blk) {
+    blk->data = aodbm_rope_empty();
+    blk->data_sz = 0;
+    blk->append_pos = aodbm_file_size(blk->db) + 5;
+}
+
+static void flush_packed_block(packed_block *blk) {
+    if (blk->data_sz == 0) {
+        return;
+    }
+    aodbm_data *dat = aodbm_rope_to_data_di(blk->data);
+    aodbm_write_data_block(blk->db, dat);
+    aodbm_free_data(dat);
+    start_packed_block(blk);
+}
+
+/* the offset that the next node will be written at, before any padding */
+static uint64_t packed_pos(packed_block *blk) {
+    if (blk->data_sz >= REPACK_BLOCK_SIZE) {
+        flush_packed_block(blk);
+    }
+    return blk->data_sz + blk->append_pos;
+}
+
+/* adds a node and its lower bound to a level, writing the node, or its
+   version header and the node if it is the root. returns the offset of
+   what was written */
+static uint64_t put_packed_node(packed_block *blk,
+                                packed_level *lvl,
+                                aodbm_data *key,
+                                aodbm_rope *node,
+                                uint64_t count,
+                                uint32_t pad,
+                                bool root) {
+    if (root) {
+        aodbm_rope_prepend_di(aodbm_version_header(blk->db, 0), node);
+    }
+    uint64_t off =
+        append_node(&blk->data, &blk->data_sz, blk->append_pos, node, pad);
+    lvl->keys[lvl->sz] = *key;
+    lvl->offs[lvl->sz] = off;
+    lvl->counts[lvl->sz] = count;
+    lvl->sz += 1;
+    return off;
+}
+
+/* writes full leaves holding the records of a version in key order, or the
+   root if they fit in one. refs has the offsets of values stored apart in
+   the new file, or is NULL */
+static packed_level pack_leaves(aodbm *db,
+                                aodbm_version ver,
+                                uint64_t n,
+                                uint64_t *refs,
+                                packed_block *blk,
+                                aodbm_version *root) {
+    /* the records are spread evenly, so that every leaf is as full as the
+       last */
+    uint64_t leaves = (n + MAX_NODE_SIZE - 1) / MAX_NODE_SIZE;
+    packed_level lvl = new_packed_level(leaves == 0 ? 1 : leaves);
+    aodbm_data keys[MAX_NODE_SIZE];
+    aodbm_data vals[MAX_NODE_SIZE];
+    aodbm_data *prev = NULL;
+    aodbm_iterator *it = n != 0 ? aodbm_new_iterator(db, ver) : NULL;
+    uint64_t i;
+    for (i = 0; i < (leaves == 0 ? 1 : leaves); ++i) {
+        uint64_t begin = leaves == 0 ? 0 : i * n / leaves;
+        uint32_t sz = leaves == 0 ? 0 : (i + 1) * n / leaves - begin;
+        uint32_t j;
+        for (j = 0; j < sz; ++j) {
+            aodbm_record rec = aodbm_iterator_next(db, it);
+            keys[j] = *rec.key;
+            vals[j] = *rec.val;
+            free(rec.key);
+            free(rec.val);
+        }
+        aodbm_data *key;
+        if (i == 0) {
+            key = aodbm_data_empty();
+        } else {
+            key = aodbm_key_separator(db, prev, &keys[0]);
+            aodbm_free_data(prev);
+        }
+        aodbm_rope *node = aodbm_encode_leaf(blk->db,
+                                             keys,
+                                             vals,
+                                             refs != NULL ? refs + begin : NULL,
+                                             sz);
+        bool is_root = leaves <= 1;
+        uint64_t pos = packed_pos(blk);
+        uint64_t node_sz = aodbm_rope_size(node);
+        if (is_root) {
+            node_sz += AODBM_VERSION_HEADER_SIZE;
+        }
+        uint64_t off = put_packed_node(blk,
+                                       &lvl,
+                                       key,
+                                       node,
+                                       sz,
+                                       node_padding(blk->db, pos, node_sz),
+                                       is_root);
+        if (is_root) {
+            *root = off;
+        }
+        free(key);
+        prev = sz != 0 ? aodbm_data_dup(&keys[sz - 1]) : NULL;
+        for (j = 0; j < sz; ++j) {
+            free(keys[j].dat);
+            free(vals[j].dat);
+        }
+    }
+    if (prev != NULL) {
+        aodbm_free_data(prev);
+    }
+    if (it != NULL) {
+        aodbm_free_iterator(it);
+    }
+    return lvl;
+}
+
+/* writes the level of full branches above the nodes of lvl, or the root if
+   they fit in one. lvl's keys are taken */
+static packed_level pack_branches(packed_level *lvl,
+                                  packed_block *blk,
+                                  aodbm_version *root) {
+    /* a branch is split once it reaches MAX_NODE_SIZE children */
+    uint64_t fanout = MAX_NODE_SIZE - 1;
+    uint64_t groups = (lvl->sz + fanout - 1) / fanout;
+    packed_level up = new_packed_level(groups);
+    uint64_t i;
+    for (i = 0; i < groups; ++i) {
+        uint64_t begin = i * lvl->sz / groups;
+        uint64_t end = (i + 1) * lvl->sz / groups;
+        branch br;
+        br.keys = lvl->keys + begin;
+        br.offs = lvl->offs + begin;
+        br.counts = lvl->counts + begin;
+        br.sz = end - begin;
+        bool is_root = groups == 1;
+        uint64_t count;
+        uint32_t pad;
+        aodbm_rope *node = place_branch_range(blk->db,
+                                              &br,
+                                              0,
+                                              br.sz,
+                                              &count,
+                                              packed_pos(blk),
+                                              is_root ?
+                                              AODBM_VERSION_HEADER_SIZE : 0,
+                                              &pad);
+        uint64_t off =
+            put_packed_node(blk, &up, &br.keys[0], node, count, pad, is_root);
+        if (is_root) {
+            *root = off;
+        }
+        uint64_t j;
+        for (j = begin + 1; j < end; ++j) {
+            free(lvl->keys[j].dat);
+        }
+    }
+    return up;
+}
+
+bool aodbm_repack(aodbm *db,
+                  aodbm_version ver,
+                  const char *filename,
+                  int flags) {
+    /* the file is created here, so that nothing else can have written to it
+       when it is opened */
+    int fd = open(filename, O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (fd == -1) {
+        if (errno == EEXIST) {
+            return false;
+        }
+        AODBM_OS_ERROR();
+    }
+    close(fd);
+    aodbm *out = aodbm_open_with(filename,
+                                 flags & (AODBM_COMPRESS | AODBM_DEDUP),
+                                 db->order,
+                                 db->compare,
+                                 db->key_width);
+    pthread_mutex_lock(&out->rw);
+    out->node_align = db->node_align;
+    if (out->compress && db->dicts_sz != 0) {
+        aodbm_write_dict_block(out, db->dicts[db->dicts_sz - 1]);
+    }
+
+    uint64_t n = ver == 0 ? 0 : aodbm_count(db, ver, NULL, NULL);
+    /* large values are stored before the tree, so that the leaves are
+       together */
+    uint64_t *refs = NULL;
+    if (out->dedup && n != 0) {
+        refs = calloc(n, sizeof(uint64_t));
+        aodbm_iterator *it = aodbm_new_iterator(db, ver);
+        uint64_t i;
+        for (i = 0; i < n; ++i) {
+            aodbm_record rec = aodbm_iterator_next(db, it);
+            if (rec.val->sz >= AODBM_DEDUP_MIN) {
+                refs[i] = aodbm_store_value(out, rec.val);
+            }
+            aodbm_free_data(rec.key);
+            aodbm_free_data(rec.val);
+        }
+        aodbm_free_iterator(it);
+    }
+
+    /* the leaves are written in key order, then each level of branches up
+       to the root, so that a scan reads the file from start to end and the
+       top of the tree is together */
+    packed_block blk;
+    blk.db = out;
+    start_packed_block(&blk);
+    aodbm_version root = 0;
+    packed_level lvl = pack_leaves(db, ver, n, refs, &blk, &root);
+    while (root == 0) {
+        packed_level up = pack_branches(&lvl, &blk, &root);
+        free_packed_level(&lvl);
+        lvl = up;
+    }
+    free(lvl.keys[0].dat);
+    free_packed_level(&lvl);
+    flush_packed_block(&blk);
+    aodbm_free_rope(blk.data);
+    free(refs);
+
+    pthread_mutex_unlock(&out->rw);
+    aodbm_commit(out, root);
+    aodbm_close(out);
+    return true;
+}
+
+/* Find the changeset that you would apply to the prev to get to ver */
+aodbm_changeset aodbm_diff_prev(aodbm *db, aodbm_version ver) {
+    return aodbm_diff(db, aodbm_previous_version(db, ver), ver);
+}
+
+/* Find the changeset that you would apply to ver to get to the prev */
+aodbm_changeset aodbm_diff_prev_rev(aodbm *db, aodbm_version ver) {
+    return aodbm_diff(db, ver, aodbm_previous_version(db, ver));
+}
+
+/* an item in the remaining contents of a tree during a diff, either a whole
+   subtree or a single record */
+typedef struct {
+    /* the subtree, 0 for a record */
+    uint64_t node;
+    /* the record's key or a lower bound for the subtree's keys,
+       NULL when the subtree has no lower bound */
+    aodbm_data *key;
+    aodbm_data *val;
+} diff_item;
+
+static diff_item *new_diff_item(uint64_t node,
+                                aodbm_data *key,
+                                aodbm_data *val) {
+    diff_item *item = malloc(sizeof(diff_item));
+    item->node = node;
+    item->key = key;
+    item->val = val;
+    return item;
+}
+
+static void free_diff_item(diff_item *item) {
+    if (item->key != NULL) {
+        aodbm_free_data(item->key);
+    }
+    if (item->val != NULL) {
+        aodbm_free_data(item->val);
+    }
+    free(item);
+}
+
+static void push_version(aodbm_stack **items, aodbm_version ver) {
+    if (ver != 0) {
+        aodbm_stack_push(items,
+            new_diff_item(ver + AODBM_VERSION_HEADER_SIZE, NULL, NULL));
+    }
+}
+
+/* replace the subtree on the top of the stack with its contents */
+static void expand_diff_item(aodbm *db, aodbm_stack **items) {
+    diff_item *item = aodbm_stack_pop(items);
+    aodbm_stack *contents = NULL;
+    
+    aodbm_node *node = aodbm_read_node(db, item->node, true);
+    uint32_t i;
+    if (node->type == 'l') {
+        for (i = 0; i < node->sz; ++i) {
+            aodbm_stack_push(&contents,
+                             new_diff_item(0,
+                                           aodbm_data_dup(&node->keys[i]),
+                                           aodbm_node_val(db, node, i)));
+        }
+    } else {
+        /* the first child starts at the subtree's bound */
+        aodbm_stack_push(&contents,
+                         new_diff_item(node->offs[0], item->key, NULL));
+        item->key = NULL;
+        for (i = 0; i < node->sz; ++i) {
+            aodbm_stack_push(&contents,
+                             new_diff_item(node->offs[i + 1],
+                                           aodbm_data_dup(&node->keys[i]),
+                                           NULL));
+        }
+    }
+    aodbm_free_node(node);
+    free_diff_item(item);
+    
+    /* reverse the contents onto the stack, so the first comes out first */
+    while (contents != NULL) {
+        aodbm_stack_push(items, aodbm_stack_pop(&contents));
+    }
+}
+
+/* is the lower bound a below b? NULL is the lowest bound */
+static bool bound_lt(aodbm *db, aodbm_data *a, aodbm_data *b) {
+    if (b == NULL) {
+        return false;
+    }
+    return a == NULL || aodbm_key_lt(db, a, b);
+}
+
+/*
+  Find the changeset that you would apply to go from a to b.
+  
+  Both trees are walked in order, one item at a time. Versions share every
+  subtree that wasn't changed between them, so when both walks arrive at the
+  same node it is skipped without being read.
+*/
+aodbm_changeset aodbm_diff(aodbm *db, aodbm_version a, aodbm_version b) {
+    aodbm_changeset res = aodbm_changeset_empty();
+    aodbm_stack *a_items = NULL;
+    aodbm_stack *b_items = NULL;
+    push_version(&a_items, a);
+    push_version(&b_items, b);
+    
+    while (a_items != NULL || b_items != NULL) {
+        diff_item *a_item = NULL, *b_item = NULL;
+        if (a_items != NULL) {
+            a_item = aodbm_stack_pop(&a_items);
+            aodbm_stack_push(&a_items, a_item);
+        }
+        if (b_items != NULL) {
+            b_item = aodbm_stack_pop(&b_items);
+            aodbm_stack_push(&b_items, b_item);
+        }
+        
+        if (a_item != NULL && b_item != NULL &&
+            a_item->node != 0 && a_item->node == b_item->node) {
+            /* a shared subtree */
+            free_diff_item(aodbm_stack_pop(&a_items));
+            free_diff_item(aodbm_stack_pop(&b_items));
+            continue;
+        }
+        
+        bool a_node = a_item != NULL && a_item->node != 0;
+        bool b_node = b_item != NULL && b_item->node != 0;
+        if (a_node && b_node) {
+            /* expand the subtree that starts first, or both so that they
+               descend together and meet at any subtrees that they share */
+            bool a_first = bound_lt(db, a_item->key, b_item->key);
+            bool b_first = bound_lt(db, b_item->key, a_item->key);
+            if (!b_first) {
+                expand_diff_item(db, &a_items);
+            }
+            if (!a_first) {
+                expand_diff_item(db, &b_items);
+            }
+            continue;
+        }
+        /* a subtree is expanded unless the other side's record comes first */
+        if (a_node &&
+            (b_item == NULL || !bound_lt(db, b_item->key, a_item->key))) {
+            expand_diff_item(db, &a_items);
+            continue;
+        }
+        if (b_node &&
+            (a_item == NULL || !bound_lt(db, a_item->key, b_item->key))) {
+            expand_diff_item(db, &b_items);
+            continue;
+        }
+        
+        /* at least one of the items is a record that comes before the other */
+        int cmp;
+        if (a_item == NULL) {
+            cmp = 1;
+        } else if (b_item == NULL) {
+            cmp = -1;
+        } else if (a_item->node != 0) {
+            cmp = 1;
+        } else if (b_item->node != 0) {
+            cmp = -1;
+        } else {
+            cmp = aodbm_key_cmp(db, a_item->key, b_item->key);
+        }
+        
+        if (cmp < 0) {
+            aodbm_stack_pop(&a_items);
+            aodbm_changeset_add_remove_di(res, a_item->key);
+            a_item->key = NULL;
+            free_diff_item(a_item);
+        } else if (cmp > 0) {
+            aodbm_stack_pop(&b_items);
+            aodbm_changeset_add_modify_di(res, b_item->key, b_item->val);
+            b_item->key = NULL;
+            b_item->val = NULL;
+            free_diff_item(b_item);
+        } else {
+            aodbm_stack_pop(&a_items);
+            aodbm_stack_pop(&b_items);
+            if (!aodbm_data_eq(a_item->val, b_item->val)) {
+                aodbm_changeset_add_modify_di(res, b_item->key, b_item->val);
+                b_item->key = NULL;
+                b_item->val = NULL;
+            }
+            free_diff_item(a_item);
+            free_diff_item(b_item);
+        }
+    }
+    
+    return res;
+}
+
+struct aodbm_feed {
+    /* the sequence number of the last commit delivered */
+    uint64_t seq;
+};
+
+aodbm_feed *aodbm_new_feed(uint64_t seq) {
+    aodbm_feed *feed = malloc(sizeof(aodbm_feed));
+    feed->seq = seq;
+    return feed;
+}
+
+uint64_t aodbm_feed_cursor(aodbm_feed *feed) {
+    return feed->seq;
+}
+
+static aodbm_feed_entry next_feed_entry(aodbm *db, aodbm_feed *feed) {
+    aodbm_feed_entry entry;
+    aodbm_version prev = aodbm_version_at_seq(db, feed->seq);
+    feed->seq += 1;
+    entry.seq = feed->seq;
+    entry.ver = aodbm_version_at_seq(db, feed->seq);
+    entry.changes = aodbm_diff(db, prev, entry.ver);
+    return entry;
+}
+
+bool aodbm_feed_poll(aodbm *db, aodbm_feed *feed, aodbm_feed_entry *entry) {
+    if (aodbm_current_seq(db) <= feed->seq) {
+        return false;
+    }
+    *entry = next_feed_entry(db, feed);
+    return true;
+}
+
+aodbm_feed_entry aodbm_feed_wait(aodbm *db, aodbm_feed *feed) {
+    if (db->reader) {
+        /* commits are made by another process, so check the head for them */
+        while (aodbm_current_seq(db) <= feed->seq) {
+            usleep(1000);
+        }
+        return next_feed_entry(db, feed);
+    }
+    pthread_mutex_lock(&db->version);
+    while (db->commits_sz <= feed->seq) {
+        pthread_cond_wait(&db->committed, &db->version);
+    }
+    pthread_mutex_unlock(&db->version);
+    return next_feed_entry(db, feed);
+}
+
+void aodbm_free_feed(aodbm_feed *feed) {
+    free(feed);
+}
+
+uint64_t aodbm_log_size(aodbm *db) {
+    uint64_t result;
+    pthread_mutex_lock(&db->rw);
+    result = db->file_size;
+    pthread_mutex_unlock(&db->rw);
+    return result;
+}
+
+static void write_fd(int fd, void *ptr, size_t sz) {
+    while (sz > 0) {
+        ssize_t written = write(fd, ptr, sz);
+        if (written < 0) {
+            AODBM_OS_ERROR();
+        }
+        ptr = (char *)ptr + written;
+        sz -= written;
+    }
+}
+
+/* returns false if the end of the file is reached first */
+static bool read_fd(int fd, void *ptr, size_t sz) {
+    while (sz > 0) {
+        ssize_t got = read(fd, ptr, sz);
+        if (got < 0) {
+            AODBM_OS_ERROR();
+        }
+        if (got == 0) {
+            return false;
+        }
+        ptr = (char *)ptr + got;
+        sz -= got;
+    }
+    return true;
+}
+
+/*
+  chunk format:
+  offset (8 bytes), size (8 bytes), data
+*/
+
+uint64_t aodbm_ship_log(aodbm *db, uint64_t from, int fd) {
+    /* blocks are written whilst holding the lock, so the file ends with a
+       complete block */
+    pthread_mutex_lock(&db->rw);
+    uint64_t end = db->file_size;
+    if (from > end) {
+        AODBM_CUSTOM_ERROR("error, offset is beyond the end of the log");
+    }
+    if (from == end) {
+        pthread_mutex_unlock(&db->rw);
+        return end;
+    }
+    fflush(db->fd);
+    
+    uint64_t header[2];
+    header[0] = htonll(from);
+    header[1] = htonll(end - from);
+    write_fd(fd, header, 16);
+    
+    char buffer[65536];
+    uint64_t pos;
+    for (pos = from; pos < end; pos += sizeof(buffer)) {
+        size_t sz = end - pos < sizeof(buffer) ? end - pos : sizeof(buffer);
+        aodbm_read(db, pos, sz, buffer);
+        write_fd(fd, buffer, sz);
+    }
+    pthread_mutex_unlock(&db->rw);
+    return end;
+}
+
+bool aodbm_ingest_log(aodbm *db, int fd) {
+    uint64_t header[2];
+    if (!read_fd(fd, header, 16)) {
+        return false;
+    }
+    uint64_t from = ntohll(header[0]);
+    uint64_t sz = ntohll(header[1]);
+    
+    pthread_mutex_lock(&db->version);
+    pthread_mutex_lock(&db->rw);
+    uint64_t begin = db->file_size;
+    if (from != begin) {
+        AODBM_CUSTOM_ERROR("error, the chunk doesn't follow on from the log");
+    }
+    
+    char buffer[65536];
+    uint64_t left = sz;
+    aodbm_seek(db, 0, SEEK_END);
+    while (left > 0) {
+        size_t part = left < sizeof(buffer) ? left : sizeof(buffer);
+        if (!read_fd(fd, buffer, part)) {
+            AODBM_CUSTOM_ERROR("error, the chunk is incomplete");
+        }
+        aodbm_write_bytes(db, buffer, part);
+        left -= part;
+    }
+    fflush(db->fd);
+    
+    /* check the framing of the new blocks and move the head forwards */
+    uint64_t seq = db->commits_sz;
+    if (aodbm_scan_blocks(db, begin, begin + sz) != begin + sz) {
+        aodbm_truncate(db, begin);
+        AODBM_CUSTOM_ERROR("error, the chunk ends with an incomplete block");
+    }
+    pthread_mutex_unlock(&db->rw);
+    
+    if (db->commits_sz != seq) {
+        pthread_cond_broadcast(&db->committed);
+    }
+    pthread_mutex_unlock(&db->version);
+    return true;
+}
+
+aodbm_version aodbm_apply(aodbm *db, aodbm_version ver, aodbm_changeset ch) {
+    if (db->read_only) {
+        return 0;
+    }
     aodbm_list_iterator *it;
     for (it = aodbm_list_begin(ch.list);
          !aodbm_list_iterator_is_finished(it);
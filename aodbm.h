@@ -42,16 +42,111 @@ typedef struct aodbm_data aodbm_data;
 
 typedef uint64_t aodbm_version;
 
+/* flags for aodbm_open */
+/* on a read only handle, opened with AODBM_FOLLOWER or AODBM_READER, nothing
+   is written. aodbm_commit returns false, aodbm_set, aodbm_del and
+   aodbm_apply return the 0 version and aodbm_train_dictionary does nothing */
+/* open a read only copy of a database that is kept up to date with
+   aodbm_ingest_log */
+#define AODBM_FOLLOWER 1
+/* share the database with reader processes, only one process may open a
+   database with this flag at a time */
+#define AODBM_SHARED 2
+/* open a read only view of a database shared by another process, commits
+   made by the other process become visible as they are made */
+#define AODBM_READER 4
+/* compress nodes as they are written, needs aodbm to be built with
+   AODBM_USE_ZLIB. nodes are small, so they compress much better once a
+   dictionary has been trained with aodbm_train_dictionary */
+#define AODBM_COMPRESS 8
+/* store large values once, leaves refer to a value that was recently stored
+   instead of storing another copy of it */
+#define AODBM_DEDUP 16
+
+/* key orders, a database's order is chosen when it is created and recorded in
+   the file. the empty key comes first in every order */
+/* shorter keys first, then keys of the same length by their bytes as signed
+   chars. the order of databases created without a header */
+#define AODBM_ORDER_DEFAULT 0
+/* lexicographic order over unsigned bytes, like memcmp */
+#define AODBM_ORDER_LEX 1
+/* keys are 8 byte big-endian unsigned integers */
+#define AODBM_ORDER_U64 2
+/* keys are 8 byte big-endian two's complement integers */
+#define AODBM_ORDER_I64 3
+/* the order is given by a comparator, which has to be given every time the
+   database is opened */
+#define AODBM_ORDER_CUSTOM 4
+
+/* returns a negative number, 0 or a positive number, like memcmp. it is only
+   given non-empty keys and must only return 0 for keys with the same bytes */
+typedef int (*aodbm_comparator)(aodbm_data *, aodbm_data *);
+
+/* opens a database in the order that it was created with, new databases get
+   the default order */
 aodbm *aodbm_open(const char *, int);
+/* opens a database with the given order, the comparator is only used with
+   AODBM_ORDER_CUSTOM. it is an error to open a database that was created with
+   a different order */
+aodbm *aodbm_open_ordered(const char *, int, int, aodbm_comparator);
+/* like aodbm_open_ordered, but every key of the database has the given
+   length. nodes are smaller and faster to search when keys have a fixed
+   length. databases with an integer order always have 8 byte keys */
+aodbm *aodbm_open_fixed(const char *, int, int, aodbm_comparator, uint32_t);
 void aodbm_close(aodbm *);
 
+/* builds a compression dictionary from samples of the records of a version
+   and writes it to the database, nodes written after this are compressed
+   with it */
+void aodbm_train_dictionary(aodbm *, aodbm_version);
+
+/* pads the nodes written from now on, so that none of them crosses a
+   multiple of the given number of bytes unless it is bigger than that. pass
+   the page size to have each node visit touch one page, 0 packs nodes
+   together, which is the default */
+void aodbm_align_nodes(aodbm *, uint32_t);
+
+/* writes a copy of a version to a new file, as the only commit of a new
+   database with the same key order. the leaves are full and in key order,
+   followed by each level of branches up to the root, so the copy is smaller
+   and faster to read than a version built up by updates. only the
+   AODBM_COMPRESS and AODBM_DEDUP flags are used, a compressed copy uses the
+   latest dictionary of the database. nodes are padded to the database's
+   node alignment. returns false, without writing anything, if the file
+   already exists */
+bool aodbm_repack(aodbm *, aodbm_version, const char *, int);
+
 aodbm_version aodbm_current(aodbm *);
 bool aodbm_commit(aodbm *, aodbm_version);
 
+/* commits are numbered from 1 in the order that they were made, the time of a
+   commit is given in microseconds since the epoch */
+uint64_t aodbm_current_seq(aodbm *);
+/* the version committed with the sequence number, or 0 if there is no such
+   commit (yet) */
+aodbm_version aodbm_version_at_seq(aodbm *, uint64_t);
+/* the time of the commit, or 0 if there is no commit with the sequence
+   number */
+uint64_t aodbm_commit_time(aodbm *, uint64_t);
+/* the sequence number of the last commit made at or before the given time */
+uint64_t aodbm_seq_at_time(aodbm *, uint64_t);
+/* the version that was current at the given time */
+aodbm_version aodbm_version_at_time(aodbm *, uint64_t);
+
 bool aodbm_has(aodbm *, aodbm_version, aodbm_data *);
 aodbm_version aodbm_set(aodbm *, aodbm_version, aodbm_data *, aodbm_data *);
 aodbm_data *aodbm_get(aodbm *, aodbm_version, aodbm_data *);
+/* looks up n keys at once, out[i] is set to the value of keys[i] or NULL if
+   it isn't present. cheaper than n calls to aodbm_get, as nodes that the keys
+   share are only read once */
+void aodbm_get_many(aodbm *, aodbm_version, aodbm_data **, size_t, aodbm_data **);
 aodbm_version aodbm_del(aodbm *, aodbm_version, aodbm_data *);
+/* the number of keys below the given key */
+uint64_t aodbm_rank(aodbm *, aodbm_version, aodbm_data *);
+/* the number of keys from start (inclusive) to end (exclusive), either may be
+   NULL to leave that side of the range open. branches record how many records
+   are under each child, so this doesn't read the records */
+uint64_t aodbm_count(aodbm *, aodbm_version, aodbm_data *, aodbm_data *);
 
 bool aodbm_is_based_on(aodbm *, aodbm_version, aodbm_version);
 aodbm_version aodbm_previous_version(aodbm *, aodbm_version);
@@ -64,6 +159,18 @@ aodbm_version aodbm_apply(aodbm *, aodbm_version, aodbm_changeset);
 aodbm_version aodbm_apply_di(aodbm *, aodbm_version, aodbm_changeset);
 aodbm_version aodbm_merge(aodbm *, aodbm_version, aodbm_version);
 
+/* replication API, a follower is kept up to date by sending it the bytes
+   appended to the primary's file */
+/* the size of the file, the offset to ship from to bring a follower up to
+   date */
+uint64_t aodbm_log_size(aodbm *);
+/* writes a chunk of the log starting at the offset to a file descriptor,
+   returns the offset of the end of the chunk */
+uint64_t aodbm_ship_log(aodbm *, uint64_t, int);
+/* reads a chunk from a file descriptor and adds it to a follower's log,
+   returns false at the end of the file */
+bool aodbm_ingest_log(aodbm *, int);
+
 /* iteration API */
 struct aodbm_iterator;
 typedef struct aodbm_iterator aodbm_iterator;
@@ -77,10 +184,102 @@ typedef struct aodbm_record aodbm_record;
 
 aodbm_iterator *aodbm_new_iterator(aodbm *, aodbm_version);
 aodbm_iterator *aodbm_iterate_from(aodbm *, aodbm_version, aodbm_data *);
+/* iterates over the keys from start (inclusive) to end (exclusive), either
+   may be NULL to leave that side of the range open. A reverse iterator starts
+   at the end of the range, ready for aodbm_iterator_prev */
+aodbm_iterator *aodbm_iterate_range(aodbm *,
+                                    aodbm_version,
+                                    aodbm_data *,
+                                    aodbm_data *,
+                                    bool);
+/* a reverse iterator over the keys before the given key, or every key if it
+   is NULL */
+aodbm_iterator *aodbm_iterate_reverse_from(aodbm *,
+                                           aodbm_version,
+                                           aodbm_data *);
+/* iterates over the keys that start with the given bytes. in the
+   lexicographic order, or when keys have a fixed width, the keys with a
+   prefix are together and this only reads the leaves that hold them. in the
+   default order the whole database is read */
+aodbm_iterator *aodbm_iterate_prefix(aodbm *, aodbm_version, aodbm_data *);
+/* an iterator positioned at the record with the given index, counting from
+   0 in key order */
+aodbm_iterator *aodbm_iterate_from_index(aodbm *, aodbm_version, uint64_t);
 aodbm_record aodbm_iterator_next(aodbm *, aodbm_iterator *);
+/* like aodbm_iterator_next, but only gives the key, NULL at the end. the
+   values of the leaves that it passes through aren't read */
+aodbm_data *aodbm_iterator_next_key(aodbm *, aodbm_iterator *);
+/* steps back over the record before the iterator's position, next and prev
+   can be mixed and the key and value are NULL at either end */
+aodbm_record aodbm_iterator_prev(aodbm *, aodbm_iterator *);
+/* like aodbm_iterator_prev, but only gives the key, NULL at the start */
+aodbm_data *aodbm_iterator_prev_key(aodbm *, aodbm_iterator *);
+/* copies as many of the following records as fit into a buffer, each as the
+   key's size and the value's size (uint32_ts in host order) followed by the
+   key and the value. count is set to the number of records copied and the
+   number of bytes used is returned. A count of 0 means the iteration is
+   finished if 0 is returned, otherwise the next record needs a buffer of the
+   returned size */
+size_t aodbm_iterator_next_batch(aodbm *,
+                                 aodbm_iterator *,
+                                 char *,
+                                 size_t,
+                                 size_t *);
 void aodbm_iterator_goto(aodbm *, aodbm_iterator *it, aodbm_data *);
 void aodbm_free_iterator(aodbm_iterator *);
 
+/* splits the keys from start (inclusive) to end (exclusive) into up to n
+   ranges in order, each with about the same number of records, and creates an
+   iterator for each. either bound may be NULL. returns the number of
+   iterators, which is less than n if there are fewer than n records. the
+   iterators can be used from different threads */
+size_t aodbm_partition(aodbm *,
+                       aodbm_version,
+                       aodbm_data *,
+                       aodbm_data *,
+                       size_t,
+                       aodbm_iterator **);
+
+/* called with the index of the range the record is in, the record and the
+   context given to aodbm_parallel_scan. the key and value are freed
+   afterwards */
+typedef void (*aodbm_scan_fn)(size_t, aodbm_data *, aodbm_data *, void *);
+/* partitions the range like aodbm_partition and calls the function for every
+   record, with a thread for each part. the records of a part are given in
+   order, the function has to be safe to call from several threads */
+void aodbm_parallel_scan(aodbm *,
+                         aodbm_version,
+                         aodbm_data *,
+                         aodbm_data *,
+                         size_t,
+                         aodbm_scan_fn,
+                         void *);
+
+/* change feed API, delivers the changes made by each commit in order */
+struct aodbm_feed;
+typedef struct aodbm_feed aodbm_feed;
+
+struct aodbm_feed_entry {
+    uint64_t seq;
+    aodbm_version ver;
+    /* the changes from the previously committed version to ver */
+    aodbm_changeset changes;
+};
+
+typedef struct aodbm_feed_entry aodbm_feed_entry;
+
+/* the feed delivers the commits after the given sequence number, which may
+   be beyond the latest commit. the database is given when the feed is
+   polled */
+aodbm_feed *aodbm_new_feed(uint64_t);
+/* the sequence number of the last commit delivered, for resuming later */
+uint64_t aodbm_feed_cursor(aodbm_feed *);
+/* returns false if there isn't a new commit yet */
+bool aodbm_feed_poll(aodbm *, aodbm_feed *, aodbm_feed_entry *);
+/* blocks until there is a new commit */
+aodbm_feed_entry aodbm_feed_wait(aodbm *, aodbm_feed *);
+void aodbm_free_feed(aodbm_feed *);
+
 void aodbm_free_data(aodbm_data *);
 
 #endif
@@ -18,6 +18,7 @@
 '''
 
 import ctypes
+import struct
 
 class Data(ctypes.Structure):
     _fields_ = [("dat", ctypes.c_char_p),
@@ -29,17 +30,55 @@ class Record(ctypes.Structure):
     _fields_ = [("key", data_ptr),
                 ("val", data_ptr)]
 
+AODBM_FOLLOWER = 1
+AODBM_SHARED = 2
+AODBM_READER = 4
+AODBM_COMPRESS = 8
+AODBM_DEDUP = 16
+
+AODBM_ORDER_DEFAULT = 0
+AODBM_ORDER_LEX = 1
+AODBM_ORDER_U64 = 2
+AODBM_ORDER_I64 = 3
+AODBM_ORDER_CUSTOM = 4
+
+AODBM_MODIFY = 1
+AODBM_REMOVE = 2
+
+class Change(ctypes.Structure):
+    _fields_ = [("type", ctypes.c_ubyte),
+                ("key", data_ptr),
+                ("val", data_ptr)]
+
+class Changeset(ctypes.Structure):
+    _fields_ = [("list", ctypes.c_void_p)]
+
+class FeedEntry(ctypes.Structure):
+    _fields_ = [("seq", ctypes.c_uint64),
+                ("ver", ctypes.c_uint64),
+                ("changes", Changeset)]
+
 def str_to_data(st):
     return Data(st, len(st))
 
 def data_to_str(dat):
-    return ctypes.string_at(dat.dat, dat.sz)
+    # reading dat.dat would stop at the first null byte, so use the pointer
+    ptr = ctypes.cast(ctypes.addressof(dat), ctypes.POINTER(ctypes.c_void_p))
+    return ctypes.string_at(ptr.contents.value, dat.sz)
 
 aodbm_lib = ctypes.CDLL("./libaodbm.so")
 
 aodbm_lib.aodbm_open.argtypes = [ctypes.c_char_p, ctypes.c_int]
 aodbm_lib.aodbm_open.restype = ctypes.c_void_p
 
+comparator = ctypes.CFUNCTYPE(ctypes.c_int, data_ptr, data_ptr)
+
+aodbm_lib.aodbm_open_ordered.argtypes = [ctypes.c_char_p, ctypes.c_int, ctypes.c_int, comparator]
+aodbm_lib.aodbm_open_ordered.restype = ctypes.c_void_p
+
+aodbm_lib.aodbm_open_fixed.argtypes = [ctypes.c_char_p, ctypes.c_int, ctypes.c_int, comparator, ctypes.c_uint32]
+aodbm_lib.aodbm_open_fixed.restype = ctypes.c_void_p
+
 aodbm_lib.aodbm_close.argtypes = [ctypes.c_void_p]
 aodbm_lib.aodbm_close.restype = None
 
@@ -49,12 +88,42 @@ aodbm_lib.aodbm_current.restype = ctypes.c_uint64
 aodbm_lib.aodbm_commit.argtypes = [ctypes.c_void_p, ctypes.c_uint64]
 aodbm_lib.aodbm_commit.restype = ctypes.c_bool
 
+aodbm_lib.aodbm_train_dictionary.argtypes = [ctypes.c_void_p, ctypes.c_uint64]
+aodbm_lib.aodbm_train_dictionary.restype = None
+
+aodbm_lib.aodbm_align_nodes.argtypes = [ctypes.c_void_p, ctypes.c_uint32]
+aodbm_lib.aodbm_align_nodes.restype = None
+
+aodbm_lib.aodbm_repack.argtypes = [ctypes.c_void_p,
+                                   ctypes.c_uint64,
+                                   ctypes.c_char_p,
+                                   ctypes.c_int]
+aodbm_lib.aodbm_repack.restype = ctypes.c_bool
+
+aodbm_lib.aodbm_current_seq.argtypes = [ctypes.c_void_p]
+aodbm_lib.aodbm_current_seq.restype = ctypes.c_uint64
+
+aodbm_lib.aodbm_version_at_seq.argtypes = [ctypes.c_void_p, ctypes.c_uint64]
+aodbm_lib.aodbm_version_at_seq.restype = ctypes.c_uint64
+
+aodbm_lib.aodbm_commit_time.argtypes = [ctypes.c_void_p, ctypes.c_uint64]
+aodbm_lib.aodbm_commit_time.restype = ctypes.c_uint64
+
+aodbm_lib.aodbm_seq_at_time.argtypes = [ctypes.c_void_p, ctypes.c_uint64]
+aodbm_lib.aodbm_seq_at_time.restype = ctypes.c_uint64
+
+aodbm_lib.aodbm_version_at_time.argtypes = [ctypes.c_void_p, ctypes.c_uint64]
+aodbm_lib.aodbm_version_at_time.restype = ctypes.c_uint64
+
 aodbm_lib.aodbm_has.argtypes = [ctypes.c_void_p, ctypes.c_uint64, data_ptr]
 aodbm_lib.aodbm_has.restype = ctypes.c_bool
 
 aodbm_lib.aodbm_get.argtypes = [ctypes.c_void_p, ctypes.c_uint64, data_ptr]
 aodbm_lib.aodbm_get.restype = data_ptr
 
+aodbm_lib.aodbm_get_many.argtypes = [ctypes.c_void_p, ctypes.c_uint64, ctypes.POINTER(data_ptr), ctypes.c_size_t, ctypes.POINTER(data_ptr)]
+aodbm_lib.aodbm_get_many.restype = None
+
 aodbm_lib.aodbm_set.argtypes = [ctypes.c_void_p, ctypes.c_uint64, data_ptr, data_ptr]
 aodbm_lib.aodbm_set.restype = ctypes.c_uint64
 
@@ -67,31 +136,165 @@ aodbm_lib.aodbm_is_based_on.restype = ctypes.c_bool
 aodbm_lib.aodbm_previous_version.argtypes = [ctypes.c_void_p, ctypes.c_uint64]
 aodbm_lib.aodbm_previous_version.restype = ctypes.c_uint64
 
+aodbm_lib.aodbm_common_ancestor.argtypes = [ctypes.c_void_p, ctypes.c_uint64, ctypes.c_uint64]
+aodbm_lib.aodbm_common_ancestor.restype = ctypes.c_uint64
+
+aodbm_lib.aodbm_diff.argtypes = [ctypes.c_void_p, ctypes.c_uint64, ctypes.c_uint64]
+aodbm_lib.aodbm_diff.restype = Changeset
+
+aodbm_lib.aodbm_merge.argtypes = [ctypes.c_void_p, ctypes.c_uint64, ctypes.c_uint64]
+aodbm_lib.aodbm_merge.restype = ctypes.c_uint64
+
+aodbm_lib.aodbm_free_changeset.argtypes = [Changeset]
+aodbm_lib.aodbm_free_changeset.restype = None
+
+aodbm_lib.aodbm_list_begin.argtypes = [ctypes.c_void_p]
+aodbm_lib.aodbm_list_begin.restype = ctypes.c_void_p
+
+aodbm_lib.aodbm_list_iterator_is_finished.argtypes = [ctypes.c_void_p]
+aodbm_lib.aodbm_list_iterator_is_finished.restype = ctypes.c_bool
+
+aodbm_lib.aodbm_list_iterator_get.argtypes = [ctypes.c_void_p]
+aodbm_lib.aodbm_list_iterator_get.restype = ctypes.POINTER(Change)
+
+aodbm_lib.aodbm_list_iterator_next.argtypes = [ctypes.c_void_p]
+aodbm_lib.aodbm_list_iterator_next.restype = None
+
+aodbm_lib.aodbm_free_list_iterator.argtypes = [ctypes.c_void_p]
+aodbm_lib.aodbm_free_list_iterator.restype = None
+
+aodbm_lib.aodbm_new_feed.argtypes = [ctypes.c_uint64]
+aodbm_lib.aodbm_new_feed.restype = ctypes.c_void_p
+
+aodbm_lib.aodbm_feed_cursor.argtypes = [ctypes.c_void_p]
+aodbm_lib.aodbm_feed_cursor.restype = ctypes.c_uint64
+
+aodbm_lib.aodbm_feed_poll.argtypes = [ctypes.c_void_p, ctypes.c_void_p, ctypes.POINTER(FeedEntry)]
+aodbm_lib.aodbm_feed_poll.restype = ctypes.c_bool
+
+aodbm_lib.aodbm_feed_wait.argtypes = [ctypes.c_void_p, ctypes.c_void_p]
+aodbm_lib.aodbm_feed_wait.restype = FeedEntry
+
+aodbm_lib.aodbm_free_feed.argtypes = [ctypes.c_void_p]
+aodbm_lib.aodbm_free_feed.restype = None
+
+aodbm_lib.aodbm_log_size.argtypes = [ctypes.c_void_p]
+aodbm_lib.aodbm_log_size.restype = ctypes.c_uint64
+
+aodbm_lib.aodbm_ship_log.argtypes = [ctypes.c_void_p, ctypes.c_uint64, ctypes.c_int]
+aodbm_lib.aodbm_ship_log.restype = ctypes.c_uint64
+
+aodbm_lib.aodbm_ingest_log.argtypes = [ctypes.c_void_p, ctypes.c_int]
+aodbm_lib.aodbm_ingest_log.restype = ctypes.c_bool
+
 aodbm_lib.aodbm_new_iterator.argtypes = [ctypes.c_void_p, ctypes.c_uint64]
 aodbm_lib.aodbm_new_iterator.restype = ctypes.c_void_p
 
 aodbm_lib.aodbm_iterate_from.argtypes = [ctypes.c_void_p, ctypes.c_uint64, data_ptr]
 aodbm_lib.aodbm_iterate_from.restype = ctypes.c_void_p
 
+aodbm_lib.aodbm_iterate_from_index.argtypes = [ctypes.c_void_p, ctypes.c_uint64, ctypes.c_uint64]
+aodbm_lib.aodbm_iterate_from_index.restype = ctypes.c_void_p
+
+aodbm_lib.aodbm_rank.argtypes = [ctypes.c_void_p, ctypes.c_uint64, data_ptr]
+aodbm_lib.aodbm_rank.restype = ctypes.c_uint64
+
+aodbm_lib.aodbm_count.argtypes = [ctypes.c_void_p, ctypes.c_uint64, data_ptr, data_ptr]
+aodbm_lib.aodbm_count.restype = ctypes.c_uint64
+
+aodbm_lib.aodbm_partition.argtypes = [ctypes.c_void_p, ctypes.c_uint64, data_ptr, data_ptr, ctypes.c_size_t, ctypes.POINTER(ctypes.c_void_p)]
+aodbm_lib.aodbm_partition.restype = ctypes.c_size_t
+
+scan_fn = ctypes.CFUNCTYPE(None, ctypes.c_size_t, data_ptr, data_ptr, ctypes.c_void_p)
+
+aodbm_lib.aodbm_parallel_scan.argtypes = [ctypes.c_void_p, ctypes.c_uint64, data_ptr, data_ptr, ctypes.c_size_t, scan_fn, ctypes.c_void_p]
+aodbm_lib.aodbm_parallel_scan.restype = None
+
+aodbm_lib.aodbm_iterate_prefix.argtypes = [ctypes.c_void_p, ctypes.c_uint64, data_ptr]
+aodbm_lib.aodbm_iterate_prefix.restype = ctypes.c_void_p
+
+aodbm_lib.aodbm_iterate_range.argtypes = [ctypes.c_void_p, ctypes.c_uint64, data_ptr, data_ptr, ctypes.c_bool]
+aodbm_lib.aodbm_iterate_range.restype = ctypes.c_void_p
+
+aodbm_lib.aodbm_iterator_prev.argtypes = [ctypes.c_void_p, ctypes.c_void_p]
+aodbm_lib.aodbm_iterator_prev.restype = Record
+
 aodbm_lib.aodbm_iterator_goto.argtypes = [ctypes.c_void_p, ctypes.c_void_p, data_ptr]
 aodbm_lib.aodbm_iterator_goto.restype = None
 
 aodbm_lib.aodbm_iterator_next.argtypes = [ctypes.c_void_p, ctypes.c_void_p]
 aodbm_lib.aodbm_iterator_next.restype = Record
 
+aodbm_lib.aodbm_iterator_next_key.argtypes = [ctypes.c_void_p, ctypes.c_void_p]
+aodbm_lib.aodbm_iterator_next_key.restype = data_ptr
+
+aodbm_lib.aodbm_iterator_prev_key.argtypes = [ctypes.c_void_p, ctypes.c_void_p]
+aodbm_lib.aodbm_iterator_prev_key.restype = data_ptr
+
+aodbm_lib.aodbm_iterator_next_batch.argtypes = [ctypes.c_void_p, ctypes.c_void_p, ctypes.c_char_p, ctypes.c_size_t, ctypes.POINTER(ctypes.c_size_t)]
+aodbm_lib.aodbm_iterator_next_batch.restype = ctypes.c_size_t
+
 aodbm_lib.aodbm_free_iterator.argtypes = [ctypes.c_void_p]
 aodbm_lib.aodbm_free_iterator.restype = None
 
 aodbm_lib.aodbm_free_data.argtypes = [ctypes.c_void_p]
 aodbm_lib.aodbm_free_data.restype = None
 
+def changeset_to_list(changeset):
+    '''Converts a changeset to a list of (key, value) pairs, freeing it.
+       The value is None for removed keys'''
+    out = []
+    it = aodbm_lib.aodbm_list_begin(changeset.list)
+    while not aodbm_lib.aodbm_list_iterator_is_finished(it):
+        change = aodbm_lib.aodbm_list_iterator_get(it).contents
+        key = data_to_str(change.key.contents)
+        if change.type == AODBM_MODIFY:
+            out.append((key, data_to_str(change.val.contents)))
+        else:
+            out.append((key, None))
+        aodbm_lib.aodbm_list_iterator_next(it)
+    aodbm_lib.aodbm_free_list_iterator(it)
+    aodbm_lib.aodbm_free_changeset(changeset)
+    return out
+
+class Feed(object):
+    '''Delivers the changes made by each commit after a sequence number'''
+    def __init__(self, db, seq):
+        self.db = db
+        self.feed = aodbm_lib.aodbm_new_feed(seq)
+    
+    def __del__(self):
+        aodbm_lib.aodbm_free_feed(self.feed)
+    
+    def cursor(self):
+        '''The sequence number of the last commit delivered'''
+        return aodbm_lib.aodbm_feed_cursor(self.feed)
+    
+    def _entry(self, entry):
+        return entry.seq, Version(self.db, entry.ver), changeset_to_list(entry.changes)
+    
+    def poll(self):
+        '''Get (seq, version, changes) for the next commit or None'''
+        entry = FeedEntry()
+        if aodbm_lib.aodbm_feed_poll(self.db.db, self.feed, ctypes.byref(entry)):
+            return self._entry(entry)
+        return None
+    
+    def wait(self):
+        '''Get (seq, version, changes) for the next commit, blocking until it is made'''
+        return self._entry(aodbm_lib.aodbm_feed_wait(self.db.db, self.feed))
+
 class VersionIterator(object):
-    def __init__(self, version, it=None):
+    '''Fetches records from the database a buffer at a time'''
+    def __init__(self, version, it=None, reverse=False):
         self.version = version
         if it:
             self.it = it
         else:
             self.it = aodbm_lib.aodbm_new_iterator(version.db.db, version.version)
+        self.reverse = reverse
+        self.buf = ctypes.create_string_buffer(65536)
+        self.records = []
     
     def __del__(self):
         aodbm_lib.aodbm_free_iterator(self.it)
@@ -99,8 +302,27 @@ class VersionIterator(object):
     def __iter__(self):
         return self
     
-    def next(self):
-        rec = aodbm_lib.aodbm_iterator_next(self.version.db.db, self.it)
+    def _fill(self):
+        count = ctypes.c_size_t()
+        while True:
+            used = aodbm_lib.aodbm_iterator_next_batch(self.version.db.db, self.it, self.buf, len(self.buf), ctypes.byref(count))
+            if count.value != 0 or used == 0:
+                break
+            # the next record doesn't fit
+            self.buf = ctypes.create_string_buffer(used)
+        raw = self.buf.raw[:used]
+        records = []
+        pos = 0
+        while pos < used:
+            key_sz, val_sz = struct.unpack_from('=II', raw, pos)
+            pos += 8
+            records.append((raw[pos:pos + key_sz], raw[pos + key_sz:pos + key_sz + val_sz]))
+            pos += key_sz + val_sz
+        records.reverse()
+        self.records = records
+    
+    def _prev(self):
+        rec = aodbm_lib.aodbm_iterator_prev(self.version.db.db, self.it)
         if rec.key:
             key = data_to_str(rec.key.contents)
             val = data_to_str(rec.val.contents)
@@ -109,8 +331,32 @@ class VersionIterator(object):
             return key, val
         raise StopIteration()
     
+    def next(self):
+        if self.reverse:
+            return self._prev()
+        if not self.records:
+            self._fill()
+            if not self.records:
+                raise StopIteration()
+        return self.records.pop()
+    
+    def next_key(self):
+        '''Gives the next key, without reading its value'''
+        if self.reverse:
+            ptr = aodbm_lib.aodbm_iterator_prev_key(self.version.db.db, self.it)
+        elif self.records:
+            return self.records.pop()[0]
+        else:
+            ptr = aodbm_lib.aodbm_iterator_next_key(self.version.db.db, self.it)
+        if not ptr:
+            raise StopIteration()
+        key = data_to_str(ptr.contents)
+        aodbm_lib.aodbm_free_data(ptr)
+        return key
+    
     def goto(self, key):
-        self.it = aodbm_lib.aodbm_iterator_goto(self.version.db.db, self.it, str_to_data(key))
+        self.records = []
+        aodbm_lib.aodbm_iterator_goto(self.version.db.db, self.it, str_to_data(key))
 
 class Version(object):
     '''Represents a version of the database'''
@@ -132,6 +378,22 @@ class Version(object):
             return out
         raise KeyError()
     
+    def get_many(self, keys):
+        '''Queries the version for a list of keys, missing keys give None'''
+        n = len(keys)
+        datas = [str_to_data(key) for key in keys]
+        ptrs = (data_ptr * n)(*[ctypes.pointer(dat) for dat in datas])
+        out = (data_ptr * n)()
+        aodbm_lib.aodbm_get_many(self.db.db, self.version, ptrs, n, out)
+        result = []
+        for ptr in out:
+            if ptr:
+                result.append(data_to_str(ptr.contents))
+                aodbm_lib.aodbm_free_data(ptr)
+            else:
+                result.append(None)
+        return result
+    
     def __setitem__(self, key, val):
         '''Set a record, changing the version in place'''
         key = str_to_data(key)
@@ -162,18 +424,106 @@ class Version(object):
         '''Is this object based on other?'''
         assert self.db == other.db
         return aodbm_lib.aodbm_is_based_on(self.db.db, self.version, other.version)
+    
+    def common_ancestor(self, other):
+        '''Get the most recent version that both versions are based on'''
+        assert self.db == other.db
+        return Version(self.db, aodbm_lib.aodbm_common_ancestor(self.db.db, self.version, other.version))
 
+    def diff(self, other):
+        '''Get the changes that turn this version into other'''
+        assert self.db == other.db
+        return changeset_to_list(aodbm_lib.aodbm_diff(self.db.db, self.version, other.version))
+    
+    def merge(self, other):
+        '''Merge the changes made in other since the common ancestor'''
+        assert self.db == other.db
+        return Version(self.db, aodbm_lib.aodbm_merge(self.db.db, self.version, other.version))
+    
+    def repack(self, filename, flags=0):
+        '''Write a compact copy of this version to a new database file,
+        returns False if the file already exists'''
+        return aodbm_lib.aodbm_repack(self.db.db, self.version, filename, flags)
+    
     def __iter__(self):
         return VersionIterator(self)
     
+    def keys(self):
+        '''Iterates over the keys, without reading the values'''
+        it = VersionIterator(self)
+        while True:
+            yield it.next_key()
+    
     def iterate_from(self, key):
         return VersionIterator(self, aodbm_lib.aodbm_iterate_from(self.db.db, self.version, str_to_data(key)))
+    
+    def iterate_prefix(self, prefix):
+        '''Iterates over the keys that start with prefix'''
+        return VersionIterator(self, aodbm_lib.aodbm_iterate_prefix(self.db.db, self.version, str_to_data(prefix)))
+    
+    def iterate_range(self, start=None, end=None, reverse=False):
+        '''Iterates over the keys from start up to but not including end,
+           in descending order if reverse is set'''
+        start_ptr = None if start is None else ctypes.pointer(str_to_data(start))
+        end_ptr = None if end is None else ctypes.pointer(str_to_data(end))
+        it = aodbm_lib.aodbm_iterate_range(self.db.db, self.version, start_ptr, end_ptr, reverse)
+        return VersionIterator(self, it, reverse)
+    
+    def __reversed__(self):
+        return self.iterate_range(reverse=True)
+    
+    def partition(self, n, start=None, end=None):
+        '''Splits the keys from start up to end into at most n ranges of about
+           the same size, returning an iterator for each'''
+        start_ptr = None if start is None else ctypes.pointer(str_to_data(start))
+        end_ptr = None if end is None else ctypes.pointer(str_to_data(end))
+        its = (ctypes.c_void_p * n)()
+        count = aodbm_lib.aodbm_partition(self.db.db, self.version, start_ptr, end_ptr, n, its)
+        return [VersionIterator(self, its[i]) for i in range(count)]
+    
+    def parallel_scan(self, n, fn, start=None, end=None):
+        '''Calls fn(part, key, value) for each record from start up to end,
+           on n threads that each get one part of the range'''
+        start_ptr = None if start is None else ctypes.pointer(str_to_data(start))
+        end_ptr = None if end is None else ctypes.pointer(str_to_data(end))
+        def call(part, key, val, ctx):
+            fn(part, data_to_str(key.contents), data_to_str(val.contents))
+        aodbm_lib.aodbm_parallel_scan(self.db.db, self.version, start_ptr, end_ptr, n, scan_fn(call), None)
+    
+    def iterate_from_index(self, index):
+        '''Iterates from the record with the given index, in key order'''
+        return VersionIterator(self, aodbm_lib.aodbm_iterate_from_index(self.db.db, self.version, index))
+    
+    def rank(self, key):
+        '''The number of keys below key'''
+        return aodbm_lib.aodbm_rank(self.db.db, self.version, str_to_data(key))
+    
+    def count(self, start=None, end=None):
+        '''The number of keys from start up to but not including end'''
+        start_ptr = None if start is None else ctypes.pointer(str_to_data(start))
+        end_ptr = None if end is None else ctypes.pointer(str_to_data(end))
+        return aodbm_lib.aodbm_count(self.db.db, self.version, start_ptr, end_ptr)
 
 class AODBM(object):
     '''Represents a Database'''
-    def __init__(self, filename, flags=0):
-        '''Open a new database'''
-        self.db = aodbm_lib.aodbm_open(filename, flags)
+    def __init__(self, filename, flags=0, order=None, cmp=None, width=None):
+        '''Open a new database, order is one of the AODBM_ORDER constants and
+        cmp is a python style comparison function for AODBM_ORDER_CUSTOM. If
+        width is given every key has that length'''
+        if order is None:
+            self.db = aodbm_lib.aodbm_open(filename, flags)
+        else:
+            if cmp is None:
+                self.cmp = comparator()
+            else:
+                def compare(a, b):
+                    return cmp(data_to_str(a.contents), data_to_str(b.contents))
+                # keep the callback alive as long as the database
+                self.cmp = comparator(compare)
+            if width is None:
+                self.db = aodbm_lib.aodbm_open_ordered(filename, flags, order, self.cmp)
+            else:
+                self.db = aodbm_lib.aodbm_open_fixed(filename, flags, order, self.cmp, width)
     
     def __del__(self):
         aodbm_lib.aodbm_close(self.db)
@@ -186,3 +536,50 @@ class AODBM(object):
         '''Commits the version object to the database.'''
         assert self == version.db
         return aodbm_lib.aodbm_commit(self.db, version.version)
+    
+    def train_dictionary(self, version):
+        '''Builds a compression dictionary from the records of version, for
+        databases opened with AODBM_COMPRESS'''
+        assert self == version.db
+        aodbm_lib.aodbm_train_dictionary(self.db, version.version)
+    
+    def align_nodes(self, align):
+        '''Pads the nodes written from now on so that none crosses a multiple
+        of align bytes, unless it is bigger than that'''
+        aodbm_lib.aodbm_align_nodes(self.db, align)
+    
+    def log_size(self):
+        '''Get the offset that a follower has been brought up to'''
+        return aodbm_lib.aodbm_log_size(self.db)
+    
+    def ship_log(self, offset, fd):
+        '''Write the log from offset to a file descriptor, returns the end offset'''
+        return aodbm_lib.aodbm_ship_log(self.db, offset, fd)
+    
+    def ingest_log(self, fd):
+        '''Add a chunk from a file descriptor to a follower's log'''
+        return aodbm_lib.aodbm_ingest_log(self.db, fd)
+    
+    def feed(self, seq):
+        '''Get a feed of the commits made after sequence number seq'''
+        return Feed(self, seq)
+    
+    def current_seq(self):
+        '''Get the sequence number of the latest commit'''
+        return aodbm_lib.aodbm_current_seq(self.db)
+    
+    def version_at_seq(self, seq):
+        '''Get the version object that was committed with sequence number seq'''
+        return Version(self, aodbm_lib.aodbm_version_at_seq(self.db, seq))
+    
+    def commit_time(self, seq):
+        '''Get the time of a commit in microseconds since the epoch'''
+        return aodbm_lib.aodbm_commit_time(self.db, seq)
+    
+    def seq_at_time(self, time):
+        '''Get the sequence number of the last commit made at or before time'''
+        return aodbm_lib.aodbm_seq_at_time(self.db, time)
+    
+    def version_at_time(self, time):
+        '''Get the version object that was current at the given time'''
+        return Version(self, aodbm_lib.aodbm_version_at_time(self.db, time))
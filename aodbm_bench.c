@@ -0,0 +1,33 @@
+/*  
+    Copyright (C) 2011 aodbm authors,
+    
+    This file is part of aodbm.
+    
+    aodbm is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    aodbm is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "rwlock_bench.h"
+#include "get_bench.h"
+#include "scan_bench.h"
+#include "node_bench.h"
+#include "page_bench.h"
+
+int main(void) {
+    rwlock_bench();
+    get_bench();
+    scan_bench();
+    node_bench();
+    page_bench();
+    return 0;
+}
@@ -22,7 +22,7 @@
 #include "aodbm_error.h"
 
 static aodbm_change *create_remove_di(aodbm_data *key) {
-    aodbm_change *c = malloc(1 + sizeof(aodbm_data *));
+    aodbm_change *c = malloc(sizeof(aodbm_change));
     c->type = AODBM_REMOVE;
     c->key = key;
     return c;
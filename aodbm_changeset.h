@@ -42,7 +42,10 @@ typedef struct aodbm_changeset aodbm_changeset;
 aodbm_changeset aodbm_changeset_empty();
 void aodbm_changeset_add_modify
     (aodbm_changeset, struct aodbm_data *, struct aodbm_data *);
+void aodbm_changeset_add_modify_di
+    (aodbm_changeset, struct aodbm_data *, struct aodbm_data *);
 void aodbm_changeset_add_remove(aodbm_changeset, struct aodbm_data *);
+void aodbm_changeset_add_remove_di(aodbm_changeset, struct aodbm_data *);
 aodbm_changeset aodbm_changeset_merge_di(aodbm_changeset, aodbm_changeset);
 void aodbm_free_changeset(aodbm_changeset);
 
@@ -22,8 +22,8 @@
 
 #include <arpa/inet.h>
 
-#define ntohll(x) ( ( (uint64_t)(ntohl( (uint32_t)((x << 32) >> 32) )) << 32) |\
-    ntohl( ((uint32_t)(x >> 32)) ) )                                        
+#define ntohll(x) ( ( (uint64_t)(ntohl( (uint32_t)(((x) << 32) >> 32) )) << 32) |\
+    ntohl( ((uint32_t)((x) >> 32)) ) )                                        
 #define htonll(x) ntohll(x)
 
 #include "aodbm.h"
@@ -82,10 +82,11 @@ bool aodbm_data_lt(aodbm_data *a, aodbm_data *b) {
     } else if (a->sz > b->sz) {
         return false;
     } else {
+        /* the bytes are signed, whatever the signedness of char */
         for (p = 0; p < a->sz; ++p) {
-            if (a->dat[p] < b->dat[p])
+            if ((signed char)a->dat[p] < (signed char)b->dat[p])
                 return true;
-            if (a->dat[p] > b->dat[p])
+            if ((signed char)a->dat[p] > (signed char)b->dat[p])
                 return false;
         }
         return false;
@@ -108,23 +109,69 @@ bool aodbm_data_eq(aodbm_data *a, aodbm_data *b) {
     if (a->sz != b->sz) {
         return false;
     }
-    uint32_t i;
-    for (i = 0; i < a->sz; ++i) {
-        if (a->dat[i] != b->dat[i]) {
-            return false;
+    return a->sz == 0 || memcmp(a->dat, b->dat, a->sz) == 0;
+}
+
+int aodbm_data_cmp(aodbm_data *a, aodbm_data *b) {
+    if (a->sz != b->sz) {
+        return a->sz < b->sz ? -1 : 1;
+    }
+    /* the bytes are compared as signed chars on every platform, so that
+       files have the same order everywhere and the byte 0x80 is the lowest */
+    size_t p;
+    for (p = 0; p < a->sz; ++p) {
+        if (a->dat[p] != b->dat[p]) {
+            return (signed char)a->dat[p] < (signed char)b->dat[p] ? -1 : 1;
         }
     }
-    return true;
+    return 0;
 }
 
-int aodbm_data_cmp(aodbm_data *a, aodbm_data *b) {
-    if (aodbm_data_eq(a, b)) {
-        return 0;
+/* lexicographic order over unsigned bytes, a prefix comes first */
+int aodbm_data_cmp_lex(aodbm_data *a, aodbm_data *b) {
+    size_t sz = a->sz < b->sz ? a->sz : b->sz;
+    int cmp = sz == 0 ? 0 : memcmp(a->dat, b->dat, sz);
+    if (cmp != 0) {
+        return cmp < 0 ? -1 : 1;
+    }
+    if (a->sz != b->sz) {
+        return a->sz < b->sz ? -1 : 1;
+    }
+    return 0;
+}
+
+/* 8 byte big-endian unsigned integers, keys of other sizes are ordered by size
+   before or after them */
+int aodbm_data_cmp_u64(aodbm_data *a, aodbm_data *b) {
+    if (a->sz != 8 || b->sz != 8) {
+        return aodbm_data_cmp(a, b);
+    }
+    uint64_t x, y;
+    memcpy(&x, a->dat, 8);
+    memcpy(&y, b->dat, 8);
+    x = ntohll(x);
+    y = ntohll(y);
+    if (x != y) {
+        return x < y ? -1 : 1;
+    }
+    return 0;
+}
+
+/* 8 byte big-endian two's complement integers */
+int aodbm_data_cmp_i64(aodbm_data *a, aodbm_data *b) {
+    if (a->sz != 8 || b->sz != 8) {
+        return aodbm_data_cmp(a, b);
     }
-    if (aodbm_data_lt(a, b)) {
-        return -1;
+    uint64_t x, y;
+    memcpy(&x, a->dat, 8);
+    memcpy(&y, b->dat, 8);
+    /* flipping the sign bit makes the order unsigned */
+    x = ntohll(x) ^ ((uint64_t)1 << 63);
+    y = ntohll(y) ^ ((uint64_t)1 << 63);
+    if (x != y) {
+        return x < y ? -1 : 1;
     }
-    return 1;
+    return 0;
 }
 
 aodbm_data *aodbm_data_dup(aodbm_data *v) {
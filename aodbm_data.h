@@ -44,6 +44,9 @@ bool aodbm_data_le(aodbm_data *, aodbm_data *);
 bool aodbm_data_ge(aodbm_data *, aodbm_data *);
 bool aodbm_data_eq(aodbm_data *, aodbm_data *);
 int aodbm_data_cmp(aodbm_data *, aodbm_data *);
+int aodbm_data_cmp_lex(aodbm_data *, aodbm_data *);
+int aodbm_data_cmp_u64(aodbm_data *, aodbm_data *);
+int aodbm_data_cmp_i64(aodbm_data *, aodbm_data *);
 
 /* data printing */
 void aodbm_print_data(aodbm_data *);
@@ -25,12 +25,14 @@
 #include "pthread.h"
 
 #include "aodbm_internal.h"
+#include "aodbm_node.h"
 #include "aodbm_error.h"
 
 #include <arpa/inet.h>
+#include <fcntl.h>
 
-#define ntohll(x) ( ( (uint64_t)(ntohl( (uint32_t)((x << 32) >> 32) )) << 32) |\
-    ntohl( ((uint32_t)(x >> 32)) ) )                                        
+#define ntohll(x) ( ( (uint64_t)(ntohl( (uint32_t)(((x) << 32) >> 32) )) << 32) |\
+    ntohl( ((uint32_t)((x) >> 32)) ) )                                        
 #define htonll(x) ntohll(x)
 
 #ifdef AODBM_USE_MMAP
@@ -78,15 +80,54 @@ void annotate_rope(const char *name, aodbm_rope *val) {
 /*
   data format:
   v - v + 8 = prev version
-  v + 8 = root node
-  node - node + 1 = type (leaf of branch)
-  node + 1 - node + 5 = node size
-  branch:
-  node + 5 ... = offset (key, offset)+
-  leaf:
-  node + 5 ... = (key, val)+
+  v + 8 - v + 16 = depth (number of versions in the history, including v)
+  v + 16 - v + 24 = jump (an ancestor of v, used to skip through history)
+  v + 24 = root node, see aodbm_node.c for the format of nodes
+  
+  block format:
+  h, key order (4 bytes), key width (4 bytes), only ever the first block
+  d, size (4 bytes), data
+  v, version (8 bytes), sequence number (8 bytes), commit time (8 bytes)
 */
 
+/* a one byte hash of a key, a leaf keeps one per record so that lookups only
+   need to compare the keys whose fingerprints match */
+unsigned char aodbm_fingerprint(aodbm_data *key) {
+    /* FNV-1a, folded into a byte */
+    uint32_t hash = 2166136261u;
+    size_t i;
+    for (i = 0; i < key->sz; ++i) {
+        hash ^= (unsigned char)key->dat[i];
+        hash *= 16777619u;
+    }
+    return (unsigned char)(hash ^ (hash >> 8) ^ (hash >> 16) ^ (hash >> 24));
+}
+
+aodbm_data *aodbm_key_separator(aodbm *db, aodbm_data *a, aodbm_data *b) {
+    if (db->key_width != 0) {
+        /* every key has to have the width */
+        return aodbm_data_dup(b);
+    }
+    if (db->order == AODBM_ORDER_LEX) {
+        /* the part of b up to and including the first byte that differs
+           from a */
+        size_t n = a->sz < b->sz ? a->sz : b->sz;
+        size_t i = 0;
+        while (i < n && a->dat[i] == b->dat[i]) {
+            i += 1;
+        }
+        return aodbm_construct_data(b->dat, i + 1);
+    }
+    if (db->order == AODBM_ORDER_DEFAULT && a->sz + 1 < b->sz) {
+        /* a key one byte longer than a comes after it, the lowest such key
+           has every byte set to -128 */
+        aodbm_data *out = aodbm_construct_data(b->dat, a->sz + 1);
+        memset(out->dat, 0x80, out->sz);
+        return out;
+    }
+    return aodbm_data_dup(b);
+}
+
 aodbm_rope *make_block(aodbm_data *dat) {
     aodbm_rope *result = aodbm_data_to_rope_di(aodbm_data_from_32(dat->sz));
     aodbm_rope_append(result, dat);
@@ -97,14 +138,6 @@ aodbm_rope *make_block_di(aodbm_data *dat) {
     return aodbm_data2_to_rope_di(aodbm_data_from_32(dat->sz), dat);
 }
 
-aodbm_rope *make_record(aodbm_data *key, aodbm_data *val) {
-    return aodbm_rope_merge_di(make_block(key), make_block(val));
-}
-
-aodbm_rope *make_record_di(aodbm_data *key, aodbm_data *val) {
-    return aodbm_rope_merge_di(make_block_di(key), make_block_di(val));
-}
-
 bool aodbm_read_bytes(aodbm *db, void *ptr, size_t sz) {
     if (fread(ptr, 1, sz, db->fd) != sz) {
         if (feof(db->fd)) {
@@ -146,28 +179,112 @@ void aodbm_write_data_block(aodbm *db, aodbm_data *data) {
     uint32_t sz = htonl(data->sz);
     aodbm_write_bytes(db, &sz, 4);
     aodbm_write_bytes(db, data->dat, data->sz);
+    #ifdef AODBM_USE_MMAP
+    /* the block has to reach the file before it can be mapped */
+    fflush(db->fd);
+    #endif
     pthread_mutex_unlock(&db->rw);
 }
 
-void aodbm_write_version(aodbm *db, uint64_t ver) {
+void aodbm_write_dict_block(aodbm *db, aodbm_data *dict) {
+    pthread_mutex_lock(&db->rw);
+    aodbm_write_bytes(db, "z", 1);
+    uint32_t sz = htonl(dict->sz);
+    aodbm_write_bytes(db, &sz, 4);
+    aodbm_write_bytes(db, dict->dat, dict->sz);
+    fflush(db->fd);
+    aodbm_add_dict(db, aodbm_data_dup(dict));
+    pthread_mutex_unlock(&db->rw);
+}
+
+void aodbm_add_dict(aodbm *db, aodbm_data *dict) {
+    if (db->dicts_sz == AODBM_MAX_DICTS) {
+        AODBM_CUSTOM_ERROR("error, too many compression dictionaries");
+    }
+    db->dicts[db->dicts_sz] = dict;
+    /* the dictionary has to be in place before it can be found */
+    __sync_synchronize();
+    db->dicts_sz += 1;
+}
+
+static uint64_t value_hash(aodbm_data *val) {
+    uint64_t h = 0x9e3779b97f4a7c15ull ^ val->sz;
+    size_t i;
+    for (i = 0; i + 8 <= val->sz; i += 8) {
+        uint64_t w;
+        memcpy(&w, val->dat + i, 8);
+        h = (h ^ w) * 0xff51afd7ed558ccdull;
+        h ^= h >> 32;
+    }
+    uint64_t w = 0;
+    memcpy(&w, val->dat + i, val->sz - i);
+    h = (h ^ w) * 0xc4ceb9fe1a85ec53ull;
+    return h ^ (h >> 29);
+}
+
+/* whether the value at off is the same as val */
+static bool value_at(aodbm *db, uint64_t off, aodbm_data *val) {
+    char *buf = malloc(val->sz);
+    aodbm_read(db, off, val->sz, buf);
+    bool same = memcmp(buf, val->dat, val->sz) == 0;
+    free(buf);
+    return same;
+}
+
+uint64_t aodbm_store_value(aodbm *db, aodbm_data *val) {
+    uint64_t hash = value_hash(val);
+    aodbm_value_slot *slot =
+        &db->value_index[hash % AODBM_VALUE_INDEX_SIZE];
+    /* the hash only finds a candidate, the bytes have to match */
+    if (slot->off != 0 &&
+        slot->hash == hash &&
+        slot->sz == val->sz &&
+        value_at(db, slot->off, val)) {
+        return slot->off;
+    }
+    
+    uint64_t off = db->file_size + 5;
+    aodbm_write_bytes(db, "x", 1);
+    uint32_t sz = htonl(val->sz);
+    aodbm_write_bytes(db, &sz, 4);
+    aodbm_write_bytes(db, val->dat, val->sz);
+    #ifdef AODBM_USE_MMAP
+    fflush(db->fd);
+    #endif
+    slot->hash = hash;
+    slot->off = off;
+    slot->sz = val->sz;
+    return off;
+}
+
+uint64_t aodbm_write_version(aodbm *db,
+                             uint64_t ver,
+                             uint64_t seq,
+                             uint64_t time) {
     pthread_mutex_lock(&db->rw);
     aodbm_write_bytes(db, "v", 1);
-    uint64_t off = htonll(ver);
-    aodbm_write_bytes(db, &off, 8);
+    uint64_t record[3];
+    record[0] = htonll(ver);
+    record[1] = htonll(seq);
+    record[2] = htonll(time);
+    aodbm_write_bytes(db, record, 24);
     fflush(db->fd);
+    /* blocks appended after the record may not have reached the file */
+    uint64_t end = db->file_size;
     pthread_mutex_unlock(&db->rw);
+    return end;
 }
 
 void aodbm_read(aodbm *db, uint64_t off, size_t sz, void *ptr) {
     #ifdef AODBM_USE_MMAP
-    aodbm_rwlock_rdlock(&db->mmap_mut);
+    aodbm_brlock_rdlock(&db->mmap_mut);
     
     if (db->mapping_size < off + (uint64_t)sz) {
         long page_size = sysconf(_SC_PAGE_SIZE);
         size_t new_size = db->file_size - (db->file_size % page_size);
         
         if (new_size < off + (uint64_t)sz) {
-            aodbm_rwlock_unlock(&db->mmap_mut);
+            aodbm_brlock_rdunlock(&db->mmap_mut);
             
             pthread_mutex_lock(&db->rw);
             aodbm_seek(db, off, SEEK_SET);
@@ -176,8 +293,8 @@ void aodbm_read(aodbm *db, uint64_t off, size_t sz, void *ptr) {
             return;
         }
         
-        aodbm_rwlock_unlock(&db->mmap_mut);
-        aodbm_rwlock_wrlock(&db->mmap_mut);
+        aodbm_brlock_rdunlock(&db->mmap_mut);
+        aodbm_brlock_wrlock(&db->mmap_mut);
         if (db->mapping == NULL) {
             db->mapping = mmap(NULL,
                                new_size,
@@ -201,12 +318,12 @@ void aodbm_read(aodbm *db, uint64_t off, size_t sz, void *ptr) {
                 db->mapping_size = new_size;
             }
         }
-        aodbm_rwlock_unlock(&db->mmap_mut);
-        aodbm_rwlock_rdlock(&db->mmap_mut);
+        aodbm_brlock_wrunlock(&db->mmap_mut);
+        aodbm_brlock_rdlock(&db->mmap_mut);
     }
     
     memcpy(ptr, (void *)db->mapping + (size_t)off, sz);
-    aodbm_rwlock_unlock(&db->mmap_mut);
+    aodbm_brlock_rdunlock(&db->mmap_mut);
     #else
     pthread_mutex_lock(&db->rw);
     aodbm_seek(db, off, SEEK_SET);
@@ -236,34 +353,99 @@ aodbm_data *aodbm_read_data(aodbm *db, uint64_t off) {
     return out;
 }
 
-uint64_t aodbm_search_recursive(aodbm *db, uint64_t node, aodbm_data *key) {
-    char type;
-    aodbm_read(db, node, 1, &type);
-    if (type == 'l') {
-        return node;
+/* hints that the node at off is about to be read, this only does anything
+   when the file is mapped */
+void aodbm_prefetch(aodbm *db, uint64_t off) {
+    #ifdef AODBM_USE_MMAP
+    aodbm_brlock_rdlock(&db->mmap_mut);
+    if (off < db->mapping_size) {
+        __builtin_prefetch((void *)db->mapping + (size_t)off);
     }
-    if (type == 'b') {
-        uint32_t sz = aodbm_read32(db, node + 1);
-        uint64_t pos = node + 5;
-        /* node begins with an offset */
-        uint64_t off = aodbm_read64(db, pos);
-        pos += 8;
-        uint32_t i;
-        for (i = 0; i < sz; ++i) {
-            aodbm_data *dat = aodbm_read_data(db, pos);
-            pos += dat->sz + 4;
-            bool lt = aodbm_data_lt(key, dat);
-            aodbm_free_data(dat);
-            if (lt) {
-                return aodbm_search_recursive(db, off, key);
-            }
-            off = aodbm_read64(db, pos);
-            pos += 8;
+    aodbm_brlock_rdunlock(&db->mmap_mut);
+    #else
+    (void)db;
+    (void)off;
+    #endif
+}
+
+/* asks the kernel to start reading the bytes at off into the page cache
+   without waiting for them */
+void aodbm_readahead(aodbm *db, uint64_t off, size_t sz) {
+    #ifdef AODBM_USE_MMAP
+    aodbm_brlock_rdlock(&db->mmap_mut);
+    if (off < db->mapping_size) {
+        long page_size = sysconf(_SC_PAGE_SIZE);
+        uint64_t start = off - (off % page_size);
+        uint64_t end = off + sz;
+        if (end > db->mapping_size) {
+            end = db->mapping_size;
         }
-        return aodbm_search_recursive(db, off, key);
+        madvise((void *)db->mapping + (size_t)start,
+                (size_t)(end - start),
+                MADV_WILLNEED);
+        aodbm_brlock_rdunlock(&db->mmap_mut);
+        return;
+    }
+    aodbm_brlock_rdunlock(&db->mmap_mut);
+    #endif
+    posix_fadvise(fileno(db->fd), (off_t)off, (off_t)sz, POSIX_FADV_WILLNEED);
+}
+
+aodbm_version_info aodbm_read_version_info(aodbm *db, aodbm_version ver) {
+    aodbm_version_info info;
+    if (ver == 0) {
+        /* version 0 is the root of every history */
+        info.prev = 0;
+        info.depth = 0;
+        info.jump = 0;
+        return info;
+    }
+    uint64_t header[3];
+    aodbm_read(db, ver, AODBM_VERSION_HEADER_SIZE, header);
+    info.prev = ntohll(header[0]);
+    info.depth = ntohll(header[1]);
+    info.jump = ntohll(header[2]);
+    return info;
+}
+
+/*
+  the jump pointers form a skew binary skip list over the history, each
+  version only has one, yet any ancestor can be reached in O(log depth) steps
+*/
+aodbm_data *aodbm_version_header(aodbm *db, aodbm_version prev) {
+    aodbm_version_info p = aodbm_read_version_info(db, prev);
+    aodbm_version_info j = aodbm_read_version_info(db, p.jump);
+    aodbm_version_info jj = aodbm_read_version_info(db, j.jump);
+    
+    uint64_t jump;
+    if (p.depth - j.depth == j.depth - jj.depth) {
+        jump = j.jump;
     } else {
-        AODBM_CUSTOM_ERROR("unknown node type");
+        jump = prev;
+    }
+    
+    uint64_t header[3];
+    header[0] = htonll(prev);
+    header[1] = htonll(p.depth + 1);
+    header[2] = htonll(jump);
+    return aodbm_construct_data((const char *)header, AODBM_VERSION_HEADER_SIZE);
+}
+
+aodbm_version aodbm_ancestor_at_depth(aodbm *db,
+                                      aodbm_version ver,
+                                      uint64_t depth) {
+    aodbm_version_info info = aodbm_read_version_info(db, ver);
+    while (info.depth > depth) {
+        aodbm_version_info jump = aodbm_read_version_info(db, info.jump);
+        if (jump.depth >= depth) {
+            ver = info.jump;
+            info = jump;
+        } else {
+            ver = info.prev;
+            info = aodbm_read_version_info(db, ver);
+        }
     }
+    return ver;
 }
 
 /* returns the offset of the leaf node that the key belongs in */
@@ -271,52 +453,41 @@ uint64_t aodbm_search(aodbm *db, aodbm_version version, aodbm_data *key) {
     if (version == 0) {
         AODBM_CUSTOM_ERROR("error, given the 0 version for a search");
     }
-    return aodbm_search_recursive(db, version + 8, key);
+    uint64_t off = version + AODBM_VERSION_HEADER_SIZE;
+    while (1) {
+        aodbm_node *node = aodbm_read_node(db, off, false);
+        if (node->type == 'l') {
+            aodbm_free_node(node);
+            return off;
+        }
+        off = node->offs[aodbm_node_upper_bound(db, node, key)];
+        aodbm_free_node(node);
+    }
 }
 
 void aodbm_search_path_recursive(aodbm *db,
-                                 uint64_t node,
+                                 uint64_t off,
                                  aodbm_data *node_key,
                                  aodbm_data *key,
                                  aodbm_stack **path) {
-    assert (aodbm_data_le(node_key, key));
+    assert (aodbm_key_le(db, node_key, key));
     aodbm_path_node *path_node = malloc(sizeof(aodbm_path_node));
     path_node->key = node_key;
-    path_node->node = node;
+    path_node->node = off;
     aodbm_stack_push(path, (void *)path_node);
     
-    char type;
-    aodbm_read(db, node, 1, &type);
-    if (type == 'l') {
-        return;
-    }
-    if (type == 'b') {
-        aodbm_data *prev_key = aodbm_data_dup(node_key);
-        uint32_t sz = aodbm_read32(db, node + 1);
-        uint64_t pos = node + 5;
-        /* node begins with an offset */
-        uint64_t off = aodbm_read64(db, pos);
-        pos += 8;
-        uint32_t i;
-        aodbm_data *dat;
-        for (i = 0; i < sz; ++i) {
-            dat = aodbm_read_data(db, pos);
-            pos += dat->sz + 4;
-            if (aodbm_data_lt(key, dat)) {
-                aodbm_free_data(dat);
-                aodbm_search_path_recursive(db, off, prev_key, key, path);
-                return;
-            }
-            aodbm_free_data(prev_key);
-            prev_key = dat;
-            off = aodbm_read64(db, pos);
-            pos += 8;
+    aodbm_node *node = aodbm_read_node(db, off, false);
+    if (node->type == 'b') {
+        uint32_t i = aodbm_node_upper_bound(db, node, key);
+        aodbm_data *child_key;
+        if (i == 0) {
+            child_key = aodbm_data_dup(node_key);
+        } else {
+            child_key = aodbm_data_dup(&node->keys[i - 1]);
         }
-        aodbm_search_path_recursive(db, off, prev_key, key, path);
-        return;
-    } else {
-        AODBM_CUSTOM_ERROR("unknown node type");
+        aodbm_search_path_recursive(db, node->offs[i], child_key, key, path);
     }
+    aodbm_free_node(node);
 }
 
 aodbm_stack *aodbm_search_path(aodbm *db, aodbm_version ver, aodbm_data *key) {
@@ -324,6 +495,10 @@ aodbm_stack *aodbm_search_path(aodbm *db, aodbm_version ver, aodbm_data *key) {
         AODBM_CUSTOM_ERROR("error, given the 0 version for a search");
     }
     aodbm_stack *path = NULL;
-    aodbm_search_path_recursive(db, ver + 8, aodbm_data_empty(), key, &path);
+    aodbm_search_path_recursive(db,
+                                ver + AODBM_VERSION_HEADER_SIZE,
+                                aodbm_data_empty(),
+                                key,
+                                &path);
     return path;
 }
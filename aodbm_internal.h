@@ -26,27 +26,142 @@
 #include "aodbm_rwlock.h"
 #include "aodbm_stack.h"
 
+/* an entry in the index of committed versions */
+struct aodbm_commit_record {
+    aodbm_version ver;
+    /* microseconds since the epoch */
+    uint64_t time;
+};
+
+typedef struct aodbm_commit_record aodbm_commit_record;
+
+/* the head of a shared database, mapped by the writer and every reader.
+   gen is odd whilst the writer is updating the head */
+struct aodbm_shared_head {
+    volatile uint64_t gen;
+    volatile uint64_t file_size;
+    volatile uint64_t seq;
+};
+
+typedef struct aodbm_shared_head aodbm_shared_head;
+
+/* the most compression dictionaries a database can have, and the size of
+   each */
+#define AODBM_MAX_DICTS 256
+#define AODBM_DICT_SIZE 4096
+
+/* with AODBM_DEDUP, values at least this long are stored in blocks of their
+   own. the value index remembers where recently stored values are */
+#define AODBM_DEDUP_MIN 128
+#define AODBM_VALUE_INDEX_SIZE 4096
+
+struct aodbm_value_slot {
+    uint64_t hash;
+    uint64_t off;
+    size_t sz;
+};
+
+typedef struct aodbm_value_slot aodbm_value_slot;
+
 struct aodbm {
     uint64_t file_size;
     FILE *fd;
     pthread_mutex_t rw;
     volatile uint64_t cur;
     pthread_mutex_t version;
+    /* signalled on each commit, used with the version mutex */
+    pthread_cond_t committed;
+    /* commits[seq - 1] describes the commit with sequence number seq */
+    aodbm_commit_record *commits;
+    uint64_t commits_sz;
+    uint64_t commits_cap;
+    bool read_only;
+    /* the shared head, NULL unless opened with AODBM_SHARED or AODBM_READER */
+    aodbm_shared_head *head;
+    int head_fd;
+    bool reader;
+    /* the key order, the order given to aodbm_open_ordered is checked against
+       the file's header when it's read */
+    int order;
+    bool order_given;
+    aodbm_comparator compare;
+    /* the length of every key or 0 if keys can be any length */
+    uint32_t key_width;
+    bool width_given;
+    /* the compression dictionaries in the file, in the order they were
+       written. nodes refer to dicts[i] as dictionary i + 1. the array
+       doesn't move, so that readers can use it whilst one is added */
+    aodbm_data *dicts[AODBM_MAX_DICTS];
+    volatile uint32_t dicts_sz;
+    /* whether new nodes are compressed, with the latest dictionary */
+    bool compress;
+    /* recently decompressed nodes */
+    struct aodbm_node_cache *node_cache;
+    /* whether large values are stored once, and the index of the values
+       that were stored recently, by hash. NULL unless dedup is set */
+    bool dedup;
+    aodbm_value_slot *value_index;
+    /* nodes that fit are kept within multiples of this, 0 if they aren't */
+    uint32_t node_align;
     #ifdef AODBM_USE_MMAP
     volatile void *mapping;
     volatile uint64_t mapping_size;
-    aodbm_rwlock_t mmap_mut;
+    aodbm_brlock_t mmap_mut;
     #endif
 };
 
+/* every version begins with a header of the previous version, the depth of
+   the version in the history and a version to jump to when searching for an
+   ancestor. the root node follows the header */
+#define AODBM_VERSION_HEADER_SIZE 24
+
+struct aodbm_version_info {
+    aodbm_version prev;
+    uint64_t depth;
+    aodbm_version jump;
+};
+
+typedef struct aodbm_version_info aodbm_version_info;
+
+/* compares keys in the database's order. the built in orders are dispatched
+   directly, so that only custom orders cost an indirect call */
+static inline int aodbm_key_cmp(aodbm *db, aodbm_data *a, aodbm_data *b) {
+    switch (db->order) {
+    case AODBM_ORDER_LEX:
+        return aodbm_data_cmp_lex(a, b);
+    case AODBM_ORDER_U64:
+        return aodbm_data_cmp_u64(a, b);
+    case AODBM_ORDER_I64:
+        return aodbm_data_cmp_i64(a, b);
+    case AODBM_ORDER_CUSTOM:
+        if (a->sz == 0 || b->sz == 0) {
+            return (a->sz != 0) - (b->sz != 0);
+        }
+        return db->compare(a, b);
+    default:
+        return aodbm_data_cmp(a, b);
+    }
+}
+
+static inline bool aodbm_key_lt(aodbm *db, aodbm_data *a, aodbm_data *b) {
+    return aodbm_key_cmp(db, a, b) < 0;
+}
+
+static inline bool aodbm_key_le(aodbm *db, aodbm_data *a, aodbm_data *b) {
+    return aodbm_key_cmp(db, a, b) <= 0;
+}
+
 void print_hex(unsigned char);
 void annotate_data(const char *name, aodbm_data *);
 void annotate_rope(const char *name, aodbm_rope *);
 
+unsigned char aodbm_fingerprint(aodbm_data *);
+/* the shortest key s, in the database's order, with a < s <= b. branches use
+   these to separate their children instead of whole keys */
+aodbm_data *aodbm_key_separator(aodbm *, aodbm_data *a, aodbm_data *b);
+
 aodbm_rope *make_block(aodbm_data *);
 aodbm_rope *make_block_di(aodbm_data *);
-aodbm_rope *make_record(aodbm_data *, aodbm_data *);
-aodbm_rope *make_record_di(aodbm_data *, aodbm_data *);
 
 bool aodbm_read_bytes(aodbm *, void *, size_t);
 void aodbm_seek(aodbm *, int64_t, int);
@@ -55,11 +170,28 @@ void aodbm_write_bytes(aodbm *, void *, size_t);
 void aodbm_truncate(aodbm *, uint64_t);
 
 void aodbm_write_data_block(aodbm *db, aodbm_data *data);
-void aodbm_write_version(aodbm *db, uint64_t ver);
+void aodbm_write_dict_block(aodbm *db, aodbm_data *dict);
+/* makes a dictionary read from the file available to nodes, takes ownership */
+void aodbm_add_dict(aodbm *db, aodbm_data *dict);
+/* the offset of a copy of the value in the file. a recently stored copy is
+   used if there is one, otherwise the value is written in a block of its own.
+   the rw mutex must be held */
+uint64_t aodbm_store_value(aodbm *db, aodbm_data *val);
+/* returns the end of the version record, which has been flushed to the
+   file */
+uint64_t aodbm_write_version(aodbm *db, uint64_t ver, uint64_t seq, uint64_t time);
 void aodbm_read(aodbm *db, uint64_t off, size_t sz, void *ptr);
 uint32_t aodbm_read32(aodbm *db, uint64_t off);
 uint64_t aodbm_read64(aodbm *db, uint64_t off);
 aodbm_data *aodbm_read_data(aodbm *db, uint64_t off);
+void aodbm_prefetch(aodbm *db, uint64_t off);
+void aodbm_readahead(aodbm *db, uint64_t off, size_t sz);
+
+aodbm_version_info aodbm_read_version_info(aodbm *, aodbm_version);
+/* creates the header of a new version based on the given version */
+aodbm_data *aodbm_version_header(aodbm *, aodbm_version);
+/* finds the ancestor of a version with the given depth */
+aodbm_version aodbm_ancestor_at_depth(aodbm *, aodbm_version, uint64_t);
 
 /* returns the offset of the leaf node that the key belongs in */
 uint64_t aodbm_search(aodbm *, aodbm_version, aodbm_data *);
@@ -0,0 +1,798 @@
+/*  
+    Copyright (C) 2011 aodbm authors,
+    
+    This file is part of aodbm.
+    
+    aodbm is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    aodbm is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "stdio.h"
+#include "stdlib.h"
+#include "string.h"
+
+#include "pthread.h"
+
+#include <arpa/inet.h>
+
+#include "aodbm_node.h"
+#include "aodbm_internal.h"
+#include "aodbm_error.h"
+
+#ifdef AODBM_USE_ZLIB
+#include <zlib.h>
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define AODBM_HAVE_AVX2
+#endif
+
+#define ntohll(x) ( ( (uint64_t)(ntohl( (uint32_t)(((x) << 32) >> 32) )) << 32) |\
+    ntohl( ((uint32_t)((x) >> 32)) ) )
+#define htonll(x) ntohll(x)
+
+/*
+  node format:
+  node - node + 1 = type (leaf or branch)
+  node + 1 - node + 5 = number of keys
+  node + 5 - node + 9 = size of the keys
+  node + 9 - node + 13 = size of the values
+  node + 13 ... = keys, then values
+  
+  keys of a leaf:
+  a fingerprint of each key (see aodbm_fingerprint), then the keys
+  keys of a branch:
+  the keys
+  the keys are front coded, each as (shared, size, suffix)+ where shared is
+  the length of the prefix that it has in common with the key before it and
+  the suffix is the size bytes that follow. the first key is stored whole,
+  with a shared length of 0
+  when the database has a fixed key width the keys are stored one after
+  another without sizes, and leaves have no fingerprints
+  
+  values of a leaf:
+  (size, value)+
+  values of a branch:
+  an offset for each child, then the number of records under each child. the
+  offsets are stored as the distance back from the branch to the child,
+  children are written before their parents so this is small for the
+  children that were written with it
+  
+  the sizes, offsets and counts after the header are varints, 7 bits to a
+  byte with the least significant first and the top bit set on every byte
+  but the last
+  
+  compressed leaves have the top bit of the number of keys set, and the
+  sizes in the header are the size of the compressed body and the size of
+  the body once it's decompressed. the compressed body is the dictionary
+  (0 for none, otherwise its index in db->dicts + 1), the size of the keys
+  and then the keys and values as a raw deflate stream
+*/
+
+#define HEADER_SIZE 13
+#define NODE_COMPRESSED 0x80000000u
+/* deflate's window, the dictionaries fit inside it */
+#define WINDOW_BITS 13
+#define CACHE_SLOTS 1024
+
+typedef struct {
+    uint64_t off;
+    char *body;
+    uint32_t body_sz;
+    uint32_t keys_sz;
+} cache_slot;
+
+struct aodbm_node_cache {
+    pthread_mutex_t lock;
+    cache_slot slots[CACHE_SLOTS];
+};
+
+static uint32_t get32(const char *ptr) {
+    uint32_t n;
+    memcpy(&n, ptr, 4);
+    return ntohl(n);
+}
+
+static uint64_t get64(const char *ptr) {
+    uint64_t n;
+    memcpy(&n, ptr, 8);
+    return ntohll(n);
+}
+
+static void put32(char *ptr, uint32_t n) {
+    n = htonl(n);
+    memcpy(ptr, &n, 4);
+}
+
+static size_t varint_size(uint64_t n) {
+    size_t sz = 1;
+    while (n >= 0x80) {
+        n >>= 7;
+        sz += 1;
+    }
+    return sz;
+}
+
+static char *put_varint(char *pos, uint64_t n) {
+    while (n >= 0x80) {
+        *pos++ = (char)(n | 0x80);
+        n >>= 7;
+    }
+    *pos++ = (char)n;
+    return pos;
+}
+
+/* reads a varint and moves pos past it */
+static inline uint64_t get_varint(char **pos, const char *end) {
+    unsigned char *p = (unsigned char *)*pos;
+    /* most sizes fit in one byte */
+    if ((char *)p < end && *p < 0x80) {
+        *pos += 1;
+        return *p;
+    }
+    uint64_t n = 0;
+    unsigned int shift = 0;
+    while ((char *)p < end && shift < 64) {
+        n |= (uint64_t)(*p & 0x7f) << shift;
+        if (*p++ < 0x80) {
+            *pos = (char *)p;
+            return n;
+        }
+        shift += 7;
+    }
+    AODBM_CUSTOM_ERROR("error, a node is corrupt");
+    return 0;
+}
+
+struct aodbm_node_cache *aodbm_new_node_cache() {
+    struct aodbm_node_cache *cache = calloc(1, sizeof(struct aodbm_node_cache));
+    pthread_mutex_init(&cache->lock, NULL);
+    return cache;
+}
+
+void aodbm_free_node_cache(struct aodbm_node_cache *cache) {
+    size_t i;
+    for (i = 0; i < CACHE_SLOTS; ++i) {
+        free(cache->slots[i].body);
+    }
+    pthread_mutex_destroy(&cache->lock);
+    free(cache);
+}
+
+static cache_slot *cache_slot_for(struct aodbm_node_cache *cache,
+                                  uint64_t off) {
+    return &cache->slots[(off * 0x9e3779b97f4a7c15ull) >> 54];
+}
+
+/* copies the body of the node at the offset out of the cache, returns NULL
+   if it isn't there */
+static char *cache_get(struct aodbm_node_cache *cache,
+                       uint64_t off,
+                       uint32_t *body_sz,
+                       uint32_t *keys_sz) {
+    char *body = NULL;
+    pthread_mutex_lock(&cache->lock);
+    cache_slot *slot = cache_slot_for(cache, off);
+    if (slot->body != NULL && slot->off == off) {
+        body = malloc(slot->body_sz);
+        memcpy(body, slot->body, slot->body_sz);
+        *body_sz = slot->body_sz;
+        *keys_sz = slot->keys_sz;
+    }
+    pthread_mutex_unlock(&cache->lock);
+    return body;
+}
+
+static void cache_put(struct aodbm_node_cache *cache,
+                      uint64_t off,
+                      char *body,
+                      uint32_t body_sz,
+                      uint32_t keys_sz) {
+    pthread_mutex_lock(&cache->lock);
+    cache_slot *slot = cache_slot_for(cache, off);
+    free(slot->body);
+    slot->off = off;
+    slot->body = malloc(body_sz);
+    memcpy(slot->body, body, body_sz);
+    slot->body_sz = body_sz;
+    slot->keys_sz = keys_sz;
+    pthread_mutex_unlock(&cache->lock);
+}
+
+/* reads and decompresses the body of a compressed node */
+static char *read_compressed(aodbm *db,
+                             uint64_t off,
+                             uint32_t stored_sz,
+                             uint32_t body_sz,
+                             uint32_t *keys_sz) {
+    uint32_t cached_sz;
+    char *body = cache_get(db->node_cache, off, &cached_sz, keys_sz);
+    if (body != NULL) {
+        return body;
+    }
+    #ifdef AODBM_USE_ZLIB
+    char *stored = malloc(stored_sz);
+    aodbm_read(db, off + HEADER_SIZE, stored_sz, stored);
+    char *pos = stored, *end = stored + stored_sz;
+    uint64_t dict = get_varint(&pos, end);
+    uint64_t k_sz = get_varint(&pos, end);
+    if (dict > db->dicts_sz || k_sz > body_sz) {
+        AODBM_CUSTOM_ERROR("error, a compressed node is corrupt");
+    }
+    
+    z_stream zs;
+    memset(&zs, 0, sizeof(z_stream));
+    if (inflateInit2(&zs, -WINDOW_BITS) != Z_OK) {
+        AODBM_CUSTOM_ERROR("error, couldn't start decompressing a node");
+    }
+    if (dict != 0) {
+        aodbm_data *d = db->dicts[dict - 1];
+        inflateSetDictionary(&zs, (unsigned char *)d->dat, d->sz);
+    }
+    body = malloc(body_sz);
+    zs.next_in = (unsigned char *)pos;
+    zs.avail_in = end - pos;
+    zs.next_out = (unsigned char *)body;
+    zs.avail_out = body_sz;
+    int res = inflate(&zs, Z_FINISH);
+    inflateEnd(&zs);
+    free(stored);
+    if (res != Z_STREAM_END || zs.total_out != body_sz) {
+        AODBM_CUSTOM_ERROR("error, a compressed node is corrupt");
+    }
+    *keys_sz = k_sz;
+    cache_put(db->node_cache, off, body, body_sz, k_sz);
+    return body;
+    #else
+    AODBM_CUSTOM_ERROR("error, aodbm was built without compression");
+    return NULL;
+    #endif
+}
+
+/* rebuilds front coded keys into key_buf */
+static void decode_keys(aodbm_node *node, char *pos, char *end) {
+    char *start = pos;
+    size_t total = 0;
+    uint32_t i;
+    for (i = 0; i < node->sz; ++i) {
+        uint64_t shared = get_varint(&pos, end);
+        uint64_t suffix = get_varint(&pos, end);
+        if (suffix > (uint64_t)(end - pos)) {
+            AODBM_CUSTOM_ERROR("error, a node's keys are corrupt");
+        }
+        total += shared + suffix;
+        pos += suffix;
+    }
+    
+    node->key_buf = malloc(total);
+    char *out = node->key_buf;
+    pos = start;
+    for (i = 0; i < node->sz; ++i) {
+        uint64_t shared = get_varint(&pos, end);
+        uint64_t suffix = get_varint(&pos, end);
+        if (shared != 0 && (i == 0 || shared > node->keys[i - 1].sz)) {
+            AODBM_CUSTOM_ERROR("error, a node's keys are corrupt");
+        }
+        if (shared != 0) {
+            memcpy(out, node->keys[i - 1].dat, shared);
+        }
+        memcpy(out + shared, pos, suffix);
+        node->keys[i].dat = out;
+        node->keys[i].sz = shared + suffix;
+        out += shared + suffix;
+        pos += suffix;
+    }
+}
+
+/* each value is its size, shifted left by one, and the bytes of the value.
+   the low bit is set for values that are stored apart from the leaf, which
+   have their offset instead of their bytes */
+static void decode_vals(aodbm_node *node, char *pos, char *end) {
+    node->vals = malloc(sizeof(aodbm_data) * node->sz);
+    uint32_t i;
+    for (i = 0; i < node->sz; ++i) {
+        uint64_t tag = get_varint(&pos, end);
+        uint64_t sz = tag >> 1;
+        if (tag & 1) {
+            if (node->refs == NULL) {
+                node->refs = calloc(node->sz, sizeof(uint64_t));
+            }
+            node->refs[i] = get_varint(&pos, end);
+            if (node->refs[i] == 0) {
+                AODBM_CUSTOM_ERROR("error, a node's values are corrupt");
+            }
+            node->vals[i].sz = sz;
+            node->vals[i].dat = NULL;
+            continue;
+        }
+        if (sz > (uint64_t)(end - pos)) {
+            AODBM_CUSTOM_ERROR("error, a node's values are corrupt");
+        }
+        node->vals[i].sz = sz;
+        node->vals[i].dat = pos;
+        pos += sz;
+    }
+}
+
+aodbm_node *aodbm_read_node(aodbm *db, uint64_t off, bool vals) {
+    char header[HEADER_SIZE];
+    aodbm_read(db, off, HEADER_SIZE, header);
+    
+    aodbm_node *node = malloc(sizeof(aodbm_node));
+    node->type = header[0];
+    node->sz = get32(header + 1);
+    uint32_t keys_sz = get32(header + 5);
+    uint32_t vals_sz = get32(header + 9);
+    if (node->type != 'l' && node->type != 'b') {
+        AODBM_CUSTOM_ERROR("unknown node type");
+    }
+    /* branches can't be used without their offsets */
+    vals = vals || node->type == 'b';
+    
+    if (node->sz & NODE_COMPRESSED) {
+        node->sz &= ~NODE_COMPRESSED;
+        /* the values can't be read on their own */
+        vals = true;
+        uint32_t body_sz = vals_sz;
+        node->buf = read_compressed(db, off, keys_sz, body_sz, &keys_sz);
+        vals_sz = body_sz - keys_sz;
+    } else {
+        size_t body_sz = keys_sz + (vals ? vals_sz : 0);
+        node->buf = malloc(body_sz);
+        aodbm_read(db, off + HEADER_SIZE, body_sz, node->buf);
+    }
+    
+    node->keys = malloc(sizeof(aodbm_data) * node->sz);
+    node->vals = NULL;
+    node->refs = NULL;
+    node->offs = NULL;
+    node->counts = NULL;
+    node->fps = NULL;
+    node->vals_off = off + HEADER_SIZE + keys_sz;
+    node->vals_sz = vals_sz;
+    node->vals_buf = NULL;
+    node->key_buf = NULL;
+    
+    char *pos = node->buf;
+    uint32_t i;
+    if (db->key_width != 0) {
+        for (i = 0; i < node->sz; ++i) {
+            node->keys[i].dat = pos;
+            node->keys[i].sz = db->key_width;
+            pos += db->key_width;
+        }
+    } else {
+        if (node->type == 'l') {
+            node->fps = (unsigned char *)pos;
+            pos += node->sz;
+        }
+        decode_keys(node, pos, node->buf + keys_sz);
+    }
+    
+    pos = node->buf + keys_sz;
+    char *end = pos + vals_sz;
+    if (node->type == 'b') {
+        node->offs = malloc(sizeof(uint64_t) * (node->sz + 1));
+        node->counts = malloc(sizeof(uint64_t) * (node->sz + 1));
+        for (i = 0; i <= node->sz; ++i) {
+            uint64_t back = get_varint(&pos, end);
+            if (back == 0 || back > off) {
+                AODBM_CUSTOM_ERROR("error, a branch's children are corrupt");
+            }
+            node->offs[i] = off - back;
+        }
+        for (i = 0; i <= node->sz; ++i) {
+            node->counts[i] = get_varint(&pos, end);
+        }
+    } else if (vals) {
+        decode_vals(node, pos, end);
+    }
+    return node;
+}
+
+uint32_t aodbm_node_size(aodbm *db, uint64_t off) {
+    char header[HEADER_SIZE];
+    aodbm_read(db, off, HEADER_SIZE, header);
+    uint32_t keys_sz = get32(header + 5);
+    /* a compressed node's header holds its stored size in place of the size
+       of its keys */
+    if (get32(header + 1) & NODE_COMPRESSED) {
+        return HEADER_SIZE + keys_sz;
+    }
+    return HEADER_SIZE + keys_sz + get32(header + 9);
+}
+
+void aodbm_node_read_vals(aodbm *db, aodbm_node *node) {
+    if (node->vals != NULL || node->type != 'l') {
+        return;
+    }
+    node->vals_buf = malloc(node->vals_sz);
+    aodbm_read(db, node->vals_off, node->vals_sz, node->vals_buf);
+    decode_vals(node, node->vals_buf, node->vals_buf + node->vals_sz);
+}
+
+void aodbm_node_copy_val(aodbm *db, aodbm_node *node, uint32_t i, char *out) {
+    aodbm_data *val = &node->vals[i];
+    if (node->refs != NULL && node->refs[i] != 0) {
+        aodbm_read(db, node->refs[i], val->sz, out);
+    } else {
+        memcpy(out, val->dat, val->sz);
+    }
+}
+
+aodbm_data *aodbm_node_val(aodbm *db, aodbm_node *node, uint32_t i) {
+    if (node->refs == NULL || node->refs[i] == 0) {
+        return aodbm_data_dup(&node->vals[i]);
+    }
+    aodbm_data *val = malloc(sizeof(aodbm_data));
+    val->sz = node->vals[i].sz;
+    val->dat = malloc(val->sz);
+    aodbm_node_copy_val(db, node, i, val->dat);
+    return val;
+}
+
+void aodbm_free_node(aodbm_node *node) {
+    free(node->keys);
+    free(node->vals);
+    free(node->refs);
+    free(node->offs);
+    free(node->counts);
+    free(node->buf);
+    free(node->vals_buf);
+    free(node->key_buf);
+    free(node);
+}
+
+/*
+  8 byte keys in any of the built in orders compare like unsigned integers,
+  once they're read big-endian and xored with a bias
+*/
+static bool integer_bias(aodbm *db, uint64_t *bias) {
+    switch (db->order) {
+    case AODBM_ORDER_LEX:
+    case AODBM_ORDER_U64:
+        *bias = 0;
+        return true;
+    case AODBM_ORDER_I64:
+        *bias = (uint64_t)1 << 63;
+        return true;
+    case AODBM_ORDER_DEFAULT:
+        /* the keys all have the same length, so they're compared as signed
+           bytes */
+        *bias = 0x8080808080808080ull;
+        return true;
+    default:
+        return false;
+    }
+}
+
+/* the number of keys below k, or not above k if or_equal */
+static uint32_t count_below(const char *keys,
+                            uint32_t n,
+                            uint64_t k,
+                            uint64_t bias,
+                            bool or_equal) {
+    uint32_t count = 0;
+    uint32_t i;
+    for (i = 0; i < n; ++i) {
+        uint64_t x = get64(keys + i * 8) ^ bias;
+        count += or_equal ? x <= k : x < k;
+    }
+    return count;
+}
+
+#ifdef AODBM_HAVE_AVX2
+__attribute__((target("avx2")))
+static uint32_t count_below_avx2(const char *keys,
+                                 uint32_t n,
+                                 uint64_t k,
+                                 uint64_t bias,
+                                 bool or_equal) {
+    /* the comparisons are signed, flipping the top bit makes them unsigned */
+    const uint64_t top = (uint64_t)1 << 63;
+    const __m256i swap = _mm256_setr_epi8(7, 6, 5, 4, 3, 2, 1, 0,
+                                          15, 14, 13, 12, 11, 10, 9, 8,
+                                          7, 6, 5, 4, 3, 2, 1, 0,
+                                          15, 14, 13, 12, 11, 10, 9, 8);
+    const __m256i flip = _mm256_set1_epi64x(bias ^ top);
+    const __m256i kv = _mm256_set1_epi64x(k ^ top);
+    uint32_t count = 0;
+    uint32_t i;
+    for (i = 0; i + 4 <= n; i += 4) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(keys + i * 8));
+        v = _mm256_xor_si256(_mm256_shuffle_epi8(v, swap), flip);
+        int mask;
+        if (or_equal) {
+            /* the keys above k */
+            mask = _mm256_movemask_pd(
+                _mm256_castsi256_pd(_mm256_cmpgt_epi64(v, kv)));
+            count += 4 - __builtin_popcount(mask);
+        } else {
+            mask = _mm256_movemask_pd(
+                _mm256_castsi256_pd(_mm256_cmpgt_epi64(kv, v)));
+            count += __builtin_popcount(mask);
+        }
+    }
+    return count + count_below(keys + i * 8, n - i, k, bias, or_equal);
+}
+#endif
+
+static uint32_t count_below_fixed(const char *keys,
+                                  uint32_t n,
+                                  uint64_t k,
+                                  uint64_t bias,
+                                  bool or_equal) {
+    #ifdef AODBM_HAVE_AVX2
+    static int avx2 = -1;
+    if (avx2 == -1) {
+        avx2 = __builtin_cpu_supports("avx2") ? 1 : 0;
+    }
+    if (avx2 && n >= 4) {
+        return count_below_avx2(keys, n, k, bias, or_equal);
+    }
+    #endif
+    return count_below(keys, n, k, bias, or_equal);
+}
+
+static uint32_t bound(aodbm *db,
+                      aodbm_node *node,
+                      aodbm_data *key,
+                      bool or_equal) {
+    uint64_t bias;
+    if (db->key_width == 8 && key->sz == 8 && node->sz != 0 &&
+        integer_bias(db, &bias)) {
+        return count_below_fixed(node->keys[0].dat,
+                                 node->sz,
+                                 get64(key->dat) ^ bias,
+                                 bias,
+                                 or_equal);
+    }
+    uint32_t lo = 0, hi = node->sz;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        int cmp = aodbm_key_cmp(db, &node->keys[mid], key);
+        if (cmp < 0 || (or_equal && cmp == 0)) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+uint32_t aodbm_node_lower_bound(aodbm *db, aodbm_node *node, aodbm_data *key) {
+    return bound(db, node, key, false);
+}
+
+uint32_t aodbm_node_upper_bound(aodbm *db, aodbm_node *node, aodbm_data *key) {
+    return bound(db, node, key, true);
+}
+
+int64_t aodbm_node_find(aodbm *db, aodbm_node *node, aodbm_data *key) {
+    if (node->fps == NULL) {
+        uint32_t i = aodbm_node_lower_bound(db, node, key);
+        if (i < node->sz && aodbm_data_eq(&node->keys[i], key)) {
+            return i;
+        }
+        return -1;
+    }
+    /* only compare the keys with matching fingerprints */
+    unsigned char fp = aodbm_fingerprint(key);
+    unsigned char *match = memchr(node->fps, fp, node->sz);
+    while (match != NULL) {
+        uint32_t i = match - node->fps;
+        if (aodbm_data_eq(&node->keys[i], key)) {
+            return i;
+        }
+        match = memchr(match + 1, fp, node->sz - i - 1);
+    }
+    return -1;
+}
+
+/* the length of the prefix that key i shares with the key before it, as it is
+   front coded */
+static uint32_t shared_prefix(aodbm_data *keys, uint32_t i) {
+    if (i == 0) {
+        return 0;
+    }
+    aodbm_data *a = &keys[i - 1], *b = &keys[i];
+    size_t n = a->sz < b->sz ? a->sz : b->sz;
+    uint32_t shared = 0;
+    while (shared < n && a->dat[shared] == b->dat[shared]) {
+        shared += 1;
+    }
+    return shared;
+}
+
+static size_t keys_size(aodbm *db, aodbm_data *keys, uint32_t sz, bool leaf) {
+    if (db->key_width != 0) {
+        return (size_t)db->key_width * sz;
+    }
+    size_t total = leaf ? sz : 0;
+    uint32_t i;
+    for (i = 0; i < sz; ++i) {
+        uint32_t shared = shared_prefix(keys, i);
+        uint32_t suffix = keys[i].sz - shared;
+        total += varint_size(shared) + varint_size(suffix) + suffix;
+    }
+    return total;
+}
+
+static char *put_keys(aodbm *db, char *pos, aodbm_data *keys, uint32_t sz,
+                      bool leaf) {
+    uint32_t i;
+    if (db->key_width != 0) {
+        for (i = 0; i < sz; ++i) {
+            if (keys[i].sz != db->key_width) {
+                AODBM_CUSTOM_ERROR("error, a key doesn't have the database's width");
+            }
+            memcpy(pos, keys[i].dat, db->key_width);
+            pos += db->key_width;
+        }
+        return pos;
+    }
+    if (leaf) {
+        for (i = 0; i < sz; ++i) {
+            *pos++ = aodbm_fingerprint(&keys[i]);
+        }
+    }
+    for (i = 0; i < sz; ++i) {
+        uint32_t shared = shared_prefix(keys, i);
+        uint32_t suffix = keys[i].sz - shared;
+        pos = put_varint(pos, shared);
+        pos = put_varint(pos, suffix);
+        memcpy(pos, keys[i].dat + shared, suffix);
+        pos += suffix;
+    }
+    return pos;
+}
+
+static aodbm_data *new_node(char type, uint32_t sz, size_t k_sz, size_t v_sz) {
+    aodbm_data *dat = malloc(sizeof(aodbm_data));
+    dat->sz = HEADER_SIZE + k_sz + v_sz;
+    dat->dat = malloc(dat->sz);
+    dat->dat[0] = type;
+    put32(dat->dat + 1, sz);
+    put32(dat->dat + 5, k_sz);
+    put32(dat->dat + 9, v_sz);
+    return dat;
+}
+
+/* returns a compressed copy of a node, or the node if compressing it
+   doesn't make it smaller */
+static aodbm_data *compress_node(aodbm *db, aodbm_data *dat, size_t k_sz) {
+    #ifdef AODBM_USE_ZLIB
+    uint32_t dict = db->dicts_sz;
+    size_t body_sz = dat->sz - HEADER_SIZE;
+    z_stream zs;
+    memset(&zs, 0, sizeof(z_stream));
+    if (deflateInit2(&zs,
+                     Z_DEFAULT_COMPRESSION,
+                     Z_DEFLATED,
+                     -WINDOW_BITS,
+                     6,
+                     Z_DEFAULT_STRATEGY) != Z_OK) {
+        AODBM_CUSTOM_ERROR("error, couldn't start compressing a node");
+    }
+    if (dict != 0) {
+        aodbm_data *d = db->dicts[dict - 1];
+        deflateSetDictionary(&zs, (unsigned char *)d->dat, d->sz);
+    }
+    
+    size_t prefix_sz = varint_size(dict) + varint_size(k_sz);
+    size_t out_sz = HEADER_SIZE + prefix_sz + deflateBound(&zs, body_sz);
+    aodbm_data *out = malloc(sizeof(aodbm_data));
+    out->dat = malloc(out_sz);
+    char *pos = out->dat + HEADER_SIZE;
+    pos = put_varint(pos, dict);
+    pos = put_varint(pos, k_sz);
+    zs.next_in = (unsigned char *)dat->dat + HEADER_SIZE;
+    zs.avail_in = body_sz;
+    zs.next_out = (unsigned char *)pos;
+    zs.avail_out = out_sz - (pos - out->dat);
+    if (deflate(&zs, Z_FINISH) != Z_STREAM_END) {
+        AODBM_CUSTOM_ERROR("error, couldn't compress a node");
+    }
+    out->sz = HEADER_SIZE + prefix_sz + zs.total_out;
+    deflateEnd(&zs);
+    
+    if (out->sz >= dat->sz) {
+        aodbm_free_data(out);
+        return dat;
+    }
+    out->dat[0] = dat->dat[0];
+    put32(out->dat + 1, get32(dat->dat + 1) | NODE_COMPRESSED);
+    put32(out->dat + 5, out->sz - HEADER_SIZE);
+    put32(out->dat + 9, body_sz);
+    aodbm_free_data(dat);
+    return out;
+    #else
+    return dat;
+    #endif
+}
+
+aodbm_rope *aodbm_encode_leaf(aodbm *db,
+                              aodbm_data *keys,
+                              aodbm_data *vals,
+                              uint64_t *refs,
+                              uint32_t sz) {
+    size_t k_sz = keys_size(db, keys, sz, true);
+    size_t v_sz = 0;
+    uint32_t i;
+    for (i = 0; i < sz; ++i) {
+        uint64_t tag = (uint64_t)vals[i].sz << 1;
+        if (refs != NULL && refs[i] != 0) {
+            v_sz += varint_size(tag | 1) + varint_size(refs[i]);
+        } else {
+            v_sz += varint_size(tag) + vals[i].sz;
+        }
+    }
+    
+    aodbm_data *dat = new_node('l', sz, k_sz, v_sz);
+    char *pos = put_keys(db, dat->dat + HEADER_SIZE, keys, sz, true);
+    for (i = 0; i < sz; ++i) {
+        uint64_t tag = (uint64_t)vals[i].sz << 1;
+        if (refs != NULL && refs[i] != 0) {
+            pos = put_varint(pos, tag | 1);
+            pos = put_varint(pos, refs[i]);
+        } else {
+            pos = put_varint(pos, tag);
+            memcpy(pos, vals[i].dat, vals[i].sz);
+            pos += vals[i].sz;
+        }
+    }
+    if (db->compress) {
+        dat = compress_node(db, dat, k_sz);
+    }
+    return aodbm_data_to_rope_di(dat);
+}
+
+uint64_t aodbm_node_count(aodbm_node *node) {
+    if (node->type == 'l') {
+        return node->sz;
+    }
+    uint64_t total = 0;
+    uint32_t i;
+    for (i = 0; i <= node->sz; ++i) {
+        total += node->counts[i];
+    }
+    return total;
+}
+
+aodbm_rope *aodbm_encode_branch(aodbm *db,
+                                aodbm_data *keys,
+                                uint64_t *offs,
+                                uint64_t *counts,
+                                uint32_t sz,
+                                uint64_t off) {
+    size_t k_sz = keys_size(db, keys, sz, false);
+    size_t v_sz = 0;
+    uint32_t i;
+    for (i = 0; i <= sz; ++i) {
+        if (offs[i] >= off) {
+            AODBM_CUSTOM_ERROR("error, a child has to be written before its parent");
+        }
+        v_sz += varint_size(off - offs[i]) + varint_size(counts[i]);
+    }
+    
+    aodbm_data *dat = new_node('b', sz, k_sz, v_sz);
+    char *pos = put_keys(db, dat->dat + HEADER_SIZE, keys, sz, false);
+    for (i = 0; i <= sz; ++i) {
+        pos = put_varint(pos, off - offs[i]);
+    }
+    for (i = 0; i <= sz; ++i) {
+        pos = put_varint(pos, counts[i]);
+    }
+    return aodbm_data_to_rope_di(dat);
+}
@@ -0,0 +1,105 @@
+/*  
+    Copyright (C) 2011 aodbm authors,
+    
+    This file is part of aodbm.
+    
+    aodbm is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    aodbm is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef AODBM_NODE_H
+#define AODBM_NODE_H
+
+#include "stdint.h"
+#include "stdbool.h"
+
+#include "aodbm.h"
+#include "aodbm_rope.h"
+
+/*
+  every node is read and written through these functions, so that the rest of
+  the tree code doesn't depend on how nodes are laid out in the file
+*/
+
+/* a node read into memory, the keys and values point into its buffers */
+struct aodbm_node {
+    char type;
+    uint32_t sz;
+    /* sz keys, for a branch these separate the children */
+    aodbm_data *keys;
+    /* a leaf's values, NULL if they weren't read. a value that is stored
+       apart from the leaf has its size but a NULL dat */
+    aodbm_data *vals;
+    /* where each value that is stored apart from the leaf is, 0 for values
+       in the leaf, NULL if every value is in the leaf */
+    uint64_t *refs;
+    /* a branch's sz + 1 children, the keys of offs[i] are below keys[i] */
+    uint64_t *offs;
+    /* the number of records under each of a branch's children */
+    uint64_t *counts;
+    /* a leaf's key fingerprints, NULL if the keys have a fixed width */
+    unsigned char *fps;
+    char *buf;
+    /* where a leaf's values are in the file, so that they can be read later
+       if the node was read without them */
+    uint64_t vals_off;
+    uint32_t vals_sz;
+    char *vals_buf;
+    /* the keys rebuilt from their front coding, NULL if they have a fixed
+       width and point into buf */
+    char *key_buf;
+};
+
+typedef struct aodbm_node aodbm_node;
+
+/* reads the node at the offset, a leaf's values are only read if asked for */
+aodbm_node *aodbm_read_node(aodbm *, uint64_t, bool);
+void aodbm_free_node(aodbm_node *);
+/* reads a leaf's values if they weren't read with the node */
+void aodbm_node_read_vals(aodbm *, aodbm_node *);
+/* the number of bytes that the node at the offset takes up in the file */
+uint32_t aodbm_node_size(aodbm *, uint64_t);
+/* copies the ith value of a leaf into a buffer of its size, reading it from
+   the file if it is stored apart from the leaf */
+void aodbm_node_copy_val(aodbm *, aodbm_node *, uint32_t, char *);
+/* a copy of the ith value of a leaf */
+aodbm_data *aodbm_node_val(aodbm *, aodbm_node *, uint32_t);
+
+/* the index of the first key that isn't below the given key */
+uint32_t aodbm_node_lower_bound(aodbm *, aodbm_node *, aodbm_data *);
+/* the index of the first key above the given key, which is also the index of
+   the child of a branch that the key belongs in */
+uint32_t aodbm_node_upper_bound(aodbm *, aodbm_node *, aodbm_data *);
+/* the index of the key in a leaf or -1 */
+int64_t aodbm_node_find(aodbm *, aodbm_node *, aodbm_data *);
+/* the number of records under a node */
+uint64_t aodbm_node_count(aodbm_node *);
+
+/* a cache of recently decompressed nodes, so that nodes that are read often
+   are only decompressed once */
+struct aodbm_node_cache;
+struct aodbm_node_cache *aodbm_new_node_cache();
+void aodbm_free_node_cache(struct aodbm_node_cache *);
+
+/* leaves are compressed if the database was opened with AODBM_COMPRESS and
+   it makes them smaller. refs gives the offsets of values that are stored
+   apart from the leaf, like aodbm_node's refs, and may be NULL */
+aodbm_rope *aodbm_encode_leaf(aodbm *, aodbm_data *keys, aodbm_data *vals,
+                              uint64_t *refs, uint32_t);
+/* takes sz keys, and sz + 1 offsets and record counts. the last argument is
+   the offset that the branch will be written at, which has to be after its
+   children */
+aodbm_rope *aodbm_encode_branch(aodbm *, aodbm_data *keys, uint64_t *offs,
+                                uint64_t *counts, uint32_t, uint64_t);
+
+#endif
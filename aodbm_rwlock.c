@@ -20,6 +20,7 @@
 #include "stdio.h"
 #include "stdlib.h"
 #include "assert.h"
+#include "sched.h"
 
 #include "aodbm_rwlock.h"
 #include "aodbm_error.h"
@@ -94,3 +95,84 @@ bool aodbm_rwlock_trywrlock(aodbm_rwlock_t *lock) {
     pthread_mutex_unlock(&lock->mut);
     return result;
 }
+
+static volatile unsigned int next_slot = 0;
+static __thread unsigned int thread_slot = 0;
+
+/* the slot of the calling thread */
+static volatile size_t *slot_readers(aodbm_brlock_t *lock) {
+    if (thread_slot == 0) {
+        /* slots are handed out in turn, 0 means that there isn't one yet */
+        thread_slot = __sync_fetch_and_add(&next_slot, 1) % AODBM_BRLOCK_SLOTS + 1;
+    }
+    return &lock->slots[thread_slot - 1].readers;
+}
+
+void aodbm_brlock_init(aodbm_brlock_t *lock) {
+    if (posix_memalign((void **)&lock->slots,
+                       AODBM_CACHE_LINE,
+                       sizeof(aodbm_brlock_slot) * AODBM_BRLOCK_SLOTS) != 0) {
+        AODBM_CUSTOM_ERROR("couldn't allocate brlock");
+    }
+    unsigned int i;
+    for (i = 0; i < AODBM_BRLOCK_SLOTS; ++i) {
+        lock->slots[i].readers = 0;
+    }
+    pthread_mutex_init(&lock->mut, NULL);
+    pthread_cond_init(&lock->cnd, NULL);
+    lock->is_writing = false;
+}
+
+void aodbm_brlock_destroy(aodbm_brlock_t *lock) {
+    free(lock->slots);
+    pthread_mutex_destroy(&lock->mut);
+    pthread_cond_destroy(&lock->cnd);
+}
+
+void aodbm_brlock_rdlock(aodbm_brlock_t *lock) {
+    volatile size_t *readers = slot_readers(lock);
+    while (1) {
+        /* the increment is a full barrier, so either the writer sees the
+           reader or the reader sees the writer */
+        __sync_fetch_and_add(readers, 1);
+        if (!lock->is_writing) {
+            return;
+        }
+        __sync_fetch_and_sub(readers, 1);
+        
+        pthread_mutex_lock(&lock->mut);
+        while (lock->is_writing) {
+            pthread_cond_wait(&lock->cnd, &lock->mut);
+        }
+        pthread_mutex_unlock(&lock->mut);
+    }
+}
+
+void aodbm_brlock_rdunlock(aodbm_brlock_t *lock) {
+    __sync_fetch_and_sub(slot_readers(lock), 1);
+}
+
+void aodbm_brlock_wrlock(aodbm_brlock_t *lock) {
+    pthread_mutex_lock(&lock->mut);
+    while (lock->is_writing) {
+        pthread_cond_wait(&lock->cnd, &lock->mut);
+    }
+    lock->is_writing = true;
+    pthread_mutex_unlock(&lock->mut);
+    __sync_synchronize();
+    
+    /* new readers back off, wait for the current ones to leave */
+    unsigned int i;
+    for (i = 0; i < AODBM_BRLOCK_SLOTS; ++i) {
+        while (lock->slots[i].readers != 0) {
+            sched_yield();
+        }
+    }
+}
+
+void aodbm_brlock_wrunlock(aodbm_brlock_t *lock) {
+    pthread_mutex_lock(&lock->mut);
+    lock->is_writing = false;
+    pthread_cond_broadcast(&lock->cnd);
+    pthread_mutex_unlock(&lock->mut);
+}
@@ -19,6 +19,10 @@
 
 /*
     An implementation of a rwlock that won't stave the writers.
+    
+    aodbm_brlock_t is a "big reader" lock with the same guarantee. Readers
+    only touch a counter of their own, so they don't contend with each other,
+    but writers have to check every counter.
 */
 
 #ifndef AODBM_RWLOCK_H
@@ -48,4 +52,32 @@ void aodbm_rwlock_unlock(aodbm_rwlock_t *);
 bool aodbm_rwlock_tryrdlock(aodbm_rwlock_t *);
 bool aodbm_rwlock_trywrlock(aodbm_rwlock_t *);
 
+#define AODBM_BRLOCK_SLOTS 64
+#define AODBM_CACHE_LINE 64
+
+/* each thread is given a slot, threads that share a slot still work */
+struct aodbm_brlock_slot {
+    volatile size_t readers;
+    char padding[AODBM_CACHE_LINE - sizeof(size_t)];
+};
+
+typedef struct aodbm_brlock_slot aodbm_brlock_slot;
+
+struct aodbm_brlock_t {
+    aodbm_brlock_slot *slots;
+    pthread_mutex_t mut;
+    pthread_cond_t cnd;
+    volatile bool is_writing;
+};
+
+typedef struct aodbm_brlock_t aodbm_brlock_t;
+
+void aodbm_brlock_init(aodbm_brlock_t *);
+void aodbm_brlock_destroy(aodbm_brlock_t *);
+
+void aodbm_brlock_rdlock(aodbm_brlock_t *);
+void aodbm_brlock_rdunlock(aodbm_brlock_t *);
+void aodbm_brlock_wrlock(aodbm_brlock_t *);
+void aodbm_brlock_wrunlock(aodbm_brlock_t *);
+
 #endif
@@ -48,8 +48,46 @@ START_TEST (test_1) {
     aodbm_free_data(b);
 } END_TEST
 
+START_TEST (test_2) {
+    aodbm_data *empty = aodbm_data_empty();
+    aodbm_data *a = aodbm_data_from_str("ab");
+    aodbm_data *b = aodbm_data_from_str("b");
+    aodbm_data *c = aodbm_construct_data("\xff", 1);
+    
+    /* the default order puts shorter keys first, bytes are signed */
+    fail_unless(aodbm_data_cmp(b, a) < 0);
+    fail_unless(aodbm_data_cmp(c, b) < 0);
+    fail_unless(aodbm_data_cmp(empty, c) < 0);
+    
+    fail_unless(aodbm_data_cmp_lex(a, b) < 0);
+    fail_unless(aodbm_data_cmp_lex(b, c) < 0);
+    fail_unless(aodbm_data_cmp_lex(empty, a) < 0);
+    fail_unless(aodbm_data_cmp_lex(a, a) == 0);
+    
+    aodbm_data *neg = aodbm_data_from_64((uint64_t)-2);
+    aodbm_data *one = aodbm_data_from_64(1);
+    aodbm_data *two = aodbm_data_from_64(2);
+    
+    fail_unless(aodbm_data_cmp_u64(one, two) < 0);
+    fail_unless(aodbm_data_cmp_u64(two, neg) < 0);
+    fail_unless(aodbm_data_cmp_u64(two, two) == 0);
+    fail_unless(aodbm_data_cmp_i64(neg, one) < 0);
+    fail_unless(aodbm_data_cmp_i64(one, two) < 0);
+    fail_unless(aodbm_data_cmp_i64(neg, neg) == 0);
+    fail_unless(aodbm_data_cmp_i64(empty, neg) < 0);
+    
+    aodbm_free_data(empty);
+    aodbm_free_data(a);
+    aodbm_free_data(b);
+    aodbm_free_data(c);
+    aodbm_free_data(neg);
+    aodbm_free_data(one);
+    aodbm_free_data(two);
+} END_TEST
+
 TCase *data_test_case() {
     TCase *tc = tcase_create("data");
     tcase_add_test(tc, test_1);
+    tcase_add_test(tc, test_2);
     return tc;
 }
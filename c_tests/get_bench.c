@@ -0,0 +1,177 @@
+/*  
+    Copyright (C) 2011 aodbm authors,
+    
+    This file is part of aodbm.
+    
+    aodbm is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    aodbm is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "get_bench.h"
+#include "aodbm.h"
+#include "aodbm_data.h"
+
+#include "stdio.h"
+#include "stdlib.h"
+#include "string.h"
+#include "time.h"
+#include "unistd.h"
+
+#define RECORDS 100000
+#define ROUNDS 200
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static aodbm_data *make_key(unsigned int i) {
+    char buf[16];
+    sprintf(buf, "key%07u", i);
+    return aodbm_data_from_str(buf);
+}
+
+static void bench_batch(aodbm *db, aodbm_version ver, size_t n) {
+    aodbm_data **keys = malloc(sizeof(aodbm_data *) * n);
+    aodbm_data **out = malloc(sizeof(aodbm_data *) * n);
+    double get_time = 0.0, get_many_time = 0.0;
+    double start;
+    size_t i;
+    int round;
+    for (round = 0; round < ROUNDS; ++round) {
+        for (i = 0; i < n; ++i) {
+            keys[i] = make_key(rand() % RECORDS);
+        }
+        
+        start = now();
+        for (i = 0; i < n; ++i) {
+            out[i] = aodbm_get(db, ver, keys[i]);
+        }
+        get_time += now() - start;
+        for (i = 0; i < n; ++i) {
+            aodbm_free_data(out[i]);
+        }
+        
+        start = now();
+        aodbm_get_many(db, ver, keys, n, out);
+        get_many_time += now() - start;
+        for (i = 0; i < n; ++i) {
+            aodbm_free_data(out[i]);
+            aodbm_free_data(keys[i]);
+        }
+    }
+    printf("%10zu  %12.0f  %14.0f\n",
+           n,
+           n * ROUNDS / get_time,
+           n * ROUNDS / get_many_time);
+    free(keys);
+    free(out);
+}
+
+static void bench_has(aodbm *db, aodbm_version ver) {
+    double hit_time, miss_time;
+    double start;
+    int i;
+    
+    start = now();
+    for (i = 0; i < ROUNDS * 500; ++i) {
+        aodbm_data *key = make_key(rand() % RECORDS);
+        aodbm_has(db, ver, key);
+        aodbm_free_data(key);
+    }
+    hit_time = now() - start;
+    
+    start = now();
+    for (i = 0; i < ROUNDS * 500; ++i) {
+        /* a key between two present keys */
+        aodbm_data *key = make_key(rand() % RECORDS);
+        key->dat[key->sz - 1] = 'x';
+        aodbm_has(db, ver, key);
+        aodbm_free_data(key);
+    }
+    miss_time = now() - start;
+    
+    printf("aodbm_has per second, hits: %.0f, misses: %.0f\n",
+           ROUNDS * 500 / hit_time,
+           ROUNDS * 500 / miss_time);
+}
+
+static double width_lookups(aodbm *db) {
+    aodbm_version ver = aodbm_current(db);
+    double start;
+    unsigned int i;
+    for (i = 0; i < RECORDS; ++i) {
+        aodbm_data *key = aodbm_data_from_64(i);
+        aodbm_data *val = aodbm_data_from_str("some value");
+        ver = aodbm_set(db, ver, key, val);
+        aodbm_free_data(key);
+        aodbm_free_data(val);
+    }
+    aodbm_commit(db, ver);
+    
+    srand(0);
+    start = now();
+    for (i = 0; i < ROUNDS * 500; ++i) {
+        aodbm_data *key = aodbm_data_from_64(rand() % RECORDS);
+        aodbm_free_data(aodbm_get(db, ver, key));
+        aodbm_free_data(key);
+    }
+    return ROUNDS * 500 / (now() - start);
+}
+
+static void bench_width() {
+    double variable, fixed;
+    aodbm *db;
+    
+    unlink("benchdb");
+    db = aodbm_open_ordered("benchdb", 0, AODBM_ORDER_LEX, NULL);
+    variable = width_lookups(db);
+    aodbm_close(db);
+    
+    unlink("benchdb");
+    db = aodbm_open_fixed("benchdb", 0, AODBM_ORDER_LEX, NULL, 8);
+    fixed = width_lookups(db);
+    aodbm_close(db);
+    unlink("benchdb");
+    
+    printf("aodbm_get per second, 8 byte keys, variable width: %.0f, "
+           "fixed width: %.0f\n", variable, fixed);
+}
+
+void get_bench() {
+    unlink("benchdb");
+    aodbm *db = aodbm_open("benchdb", 0);
+    aodbm_version ver = aodbm_current(db);
+    unsigned int i;
+    for (i = 0; i < RECORDS; ++i) {
+        aodbm_data *key = make_key(i);
+        aodbm_data *val = aodbm_data_from_str("some value");
+        ver = aodbm_set(db, ver, key, val);
+        aodbm_free_data(key);
+        aodbm_free_data(val);
+    }
+    aodbm_commit(db, ver);
+    
+    srand(0);
+    printf("lookups per second, %i records\n", RECORDS);
+    printf("%10s  %12s  %14s\n", "batch size", "aodbm_get", "aodbm_get_many");
+    bench_batch(db, ver, 50);
+    bench_batch(db, ver, 500);
+    bench_has(db, ver);
+    
+    aodbm_close(db);
+    unlink("benchdb");
+    
+    bench_width();
+}
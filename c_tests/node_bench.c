@@ -0,0 +1,137 @@
+/*  
+    Copyright (C) 2011 aodbm authors,
+    
+    This file is part of aodbm.
+    
+    aodbm is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    aodbm is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "node_bench.h"
+#include "aodbm.h"
+#include "aodbm_data.h"
+
+#include "stdio.h"
+#include "stdlib.h"
+#include "string.h"
+#include "time.h"
+#include "unistd.h"
+#include "sys/stat.h"
+
+#define RECORDS 50000
+#define TENANTS 50
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static off_t file_size() {
+    struct stat st;
+    stat("benchdb", &st);
+    return st.st_size;
+}
+
+/* keys like those of an event log, a tenant and a timestamp. keys that are
+   next to each other share most of their bytes */
+static aodbm_data *make_key(unsigned int i) {
+    char buf[64];
+    unsigned int tenant = (i * 7919) % TENANTS;
+    unsigned int t = i * 37;
+    sprintf(buf,
+            "tenant-%05u/2026-10-18T%02u:%02u:%02u.%06u",
+            tenant,
+            t / 3600000 % 24,
+            t / 60000 % 60,
+            t / 1000 % 60,
+            t % 1000 * 1000);
+    return aodbm_data_from_str(buf);
+}
+
+/* values like those of an event log, small JSON objects with the same
+   fields */
+static aodbm_data *make_val(unsigned int i) {
+    static const char *types[] = {"click", "view", "scroll", "purchase"};
+    char buf[128];
+    sprintf(buf,
+            "{\"type\": \"%s\", \"user\": %u, \"n\": %u}",
+            types[i * 31 % 4],
+            i * 2654435761u % 100000,
+            i % 7 + 1);
+    return aodbm_data_from_str(buf);
+}
+
+/* the size of the file, the speed of inserts, lookups and scans with keys
+   that share long prefixes. when compressing, a dictionary is trained on the
+   first tenth of the records */
+static void run(const char *name, int flags) {
+    unlink("benchdb");
+    aodbm *db = aodbm_open_ordered("benchdb", flags, AODBM_ORDER_LEX, NULL);
+    aodbm_version ver = aodbm_current(db);
+    off_t empty = file_size();
+    unsigned int i;
+    
+    double start = now();
+    for (i = 0; i < RECORDS; ++i) {
+        if (flags & AODBM_COMPRESS && i == RECORDS / 10) {
+            aodbm_train_dictionary(db, ver);
+        }
+        aodbm_data *key = make_key(i);
+        aodbm_data *val = make_val(i);
+        ver = aodbm_set(db, ver, key, val);
+        aodbm_free_data(key);
+        aodbm_free_data(val);
+    }
+    double set_time = now() - start;
+    aodbm_commit(db, ver);
+    
+    srand(0);
+    start = now();
+    for (i = 0; i < RECORDS; ++i) {
+        aodbm_data *key = make_key(rand() % RECORDS);
+        aodbm_free_data(aodbm_get(db, ver, key));
+        aodbm_free_data(key);
+    }
+    double get_time = now() - start;
+    
+    start = now();
+    aodbm_iterator *it = aodbm_new_iterator(db, ver);
+    aodbm_record rec;
+    while ((rec = aodbm_iterator_next(db, it)).key != NULL) {
+        aodbm_free_data(rec.key);
+        aodbm_free_data(rec.val);
+    }
+    aodbm_free_iterator(it);
+    double scan_time = now() - start;
+    
+    printf("%s, %i event log records, bytes appended per aodbm_set: %.0f\n",
+           name,
+           RECORDS,
+           (double)(file_size() - empty) / RECORDS);
+    printf("per second, aodbm_set: %.0f, aodbm_get: %.0f, "
+           "aodbm_iterator_next: %.0f\n",
+           RECORDS / set_time,
+           RECORDS / get_time,
+           RECORDS / scan_time);
+    
+    aodbm_close(db);
+    unlink("benchdb");
+}
+
+void node_bench() {
+    run("uncompressed", 0);
+#ifdef AODBM_USE_ZLIB
+    run("compressed", AODBM_COMPRESS);
+#endif
+}
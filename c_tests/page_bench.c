@@ -0,0 +1,149 @@
+/*  
+    Copyright (C) 2011 aodbm authors,
+    
+    This file is part of aodbm.
+    
+    aodbm is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    aodbm is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "stdio.h"
+#include "stdlib.h"
+#include "string.h"
+#include "unistd.h"
+#include "fcntl.h"
+#include "pthread.h"
+#include "sys/resource.h"
+#include "sys/stat.h"
+
+#include "page_bench.h"
+#include "aodbm.h"
+#include "aodbm_data.h"
+#include "aodbm_internal.h"
+#include "aodbm_node.h"
+
+#define RECORDS 50000
+#define VALUE_SIZE 400
+#define LOOKUPS 20000
+
+static long faults() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_minflt + usage.ru_majflt;
+}
+
+static off_t file_size(const char *name) {
+    struct stat st;
+    stat(name, &st);
+    return st.st_size;
+}
+
+/* drops the file from the page cache, so that lookups start cold */
+static void evict(const char *name) {
+    int fd = open(name, O_RDONLY);
+    fdatasync(fd);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+}
+
+static aodbm_data *make_key(unsigned int i) {
+    char buf[32];
+    sprintf(buf, "key%08u", i * 2654435761u % RECORDS);
+    return aodbm_data_from_str(buf);
+}
+
+/* the number of pages that the nodes on the path to a key are in. the
+   kernel may map several pages on each fault, so this is what the layout
+   costs regardless of how faults are counted */
+static uint64_t path_pages(aodbm *db, aodbm_version ver, aodbm_data *key) {
+    long page = sysconf(_SC_PAGE_SIZE);
+    uint64_t off = ver + AODBM_VERSION_HEADER_SIZE;
+    uint64_t pages = 0;
+    while (true) {
+        uint64_t end = off + aodbm_node_size(db, off) - 1;
+        pages += end / page - off / page + 1;
+        aodbm_node *node = aodbm_read_node(db, off, false);
+        if (node->type == 'l') {
+            aodbm_free_node(node);
+            return pages;
+        }
+        off = node->offs[aodbm_node_upper_bound(db, node, key)];
+        aodbm_free_node(node);
+    }
+}
+
+/* the page faults per lookup, from a fresh handle on a cold file. when
+   aodbm is built with AODBM_USE_MMAP each page that a lookup touches for
+   the first time is a fault */
+static void measure(const char *name, const char *label, uint32_t align) {
+    evict(name);
+    aodbm *db = aodbm_open(name, 0);
+    aodbm_version ver = aodbm_current(db);
+    srand(0);
+    long before = faults();
+    unsigned int i;
+    for (i = 0; i < LOOKUPS; ++i) {
+        aodbm_data *key = make_key(rand() % RECORDS);
+        aodbm_free_data(aodbm_get(db, ver, key));
+        aodbm_free_data(key);
+    }
+    long after = faults();
+    
+    uint64_t pages = 0;
+    for (i = 0; i < LOOKUPS; ++i) {
+        aodbm_data *key = make_key(rand() % RECORDS);
+        pages += path_pages(db, ver, key);
+        aodbm_free_data(key);
+    }
+    
+    printf("%s, node alignment %u, file size: %lli\n",
+           label,
+           align,
+           (long long)file_size(name));
+    printf("per cold aodbm_get, page faults: %.3f, pages read: %.2f\n",
+           (double)(after - before) / LOOKUPS,
+           (double)pages / LOOKUPS);
+    aodbm_close(db);
+}
+
+static void run(uint32_t align) {
+    unlink("benchdb");
+    unlink("benchdb_packed");
+    aodbm *db = aodbm_open("benchdb", 0);
+    aodbm_align_nodes(db, align);
+    aodbm_version ver = aodbm_current(db);
+    char value[VALUE_SIZE];
+    memset(value, 'v', VALUE_SIZE);
+    unsigned int i;
+    for (i = 0; i < RECORDS; ++i) {
+        aodbm_data *key = make_key(i);
+        aodbm_data *val = aodbm_construct_data(value, VALUE_SIZE);
+        ver = aodbm_set(db, ver, key, val);
+        aodbm_free_data(key);
+        aodbm_free_data(val);
+    }
+    aodbm_commit(db, ver);
+    /* the same records, with full nodes in key order */
+    aodbm_repack(db, ver, "benchdb_packed", 0);
+    aodbm_close(db);
+    
+    measure("benchdb", "updated", align);
+    measure("benchdb_packed", "repacked", align);
+    unlink("benchdb");
+    unlink("benchdb_packed");
+}
+
+void page_bench() {
+    run(0);
+    run(sysconf(_SC_PAGE_SIZE));
+}
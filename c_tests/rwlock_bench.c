@@ -0,0 +1,103 @@
+/*  
+    Copyright (C) 2011 aodbm authors,
+    
+    This file is part of aodbm.
+    
+    aodbm is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    aodbm is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "rwlock_bench.h"
+#include "aodbm_rwlock.h"
+
+#include "stdio.h"
+#include "stdint.h"
+#include "time.h"
+#include "unistd.h"
+#include "pthread.h"
+
+#define ITERATIONS 1000000
+#define MAX_THREADS 64
+
+typedef struct {
+    void *lock;
+    bool big_reader;
+} bench_data;
+
+static void *read_loop(void *ptr) {
+    bench_data *dat = (bench_data *)ptr;
+    int i;
+    if (dat->big_reader) {
+        aodbm_brlock_t *lock = dat->lock;
+        for (i = 0; i < ITERATIONS; ++i) {
+            aodbm_brlock_rdlock(lock);
+            aodbm_brlock_rdunlock(lock);
+        }
+    } else {
+        aodbm_rwlock_t *lock = dat->lock;
+        for (i = 0; i < ITERATIONS; ++i) {
+            aodbm_rwlock_rdlock(lock);
+            aodbm_rwlock_unlock(lock);
+        }
+    }
+    return NULL;
+}
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* millions of read acquisitions per second with n threads */
+static double run(bench_data *dat, int n) {
+    pthread_t threads[MAX_THREADS];
+    int i;
+    double start = now();
+    for (i = 0; i < n; ++i) {
+        pthread_create(&threads[i], NULL, read_loop, (void *)dat);
+    }
+    for (i = 0; i < n; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+    return (double)n * ITERATIONS / (now() - start) / 1e6;
+}
+
+void rwlock_bench() {
+    aodbm_rwlock_t rwlock;
+    aodbm_brlock_t brlock;
+    aodbm_rwlock_init(&rwlock);
+    aodbm_brlock_init(&brlock);
+    
+    bench_data rw_dat, br_dat;
+    rw_dat.lock = &rwlock;
+    rw_dat.big_reader = false;
+    br_dat.lock = &brlock;
+    br_dat.big_reader = true;
+    
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpus < 8) {
+        cpus = 8;
+    }
+    printf("read lock acquisitions (millions per second)\n");
+    printf("threads  aodbm_rwlock  aodbm_brlock\n");
+    int n;
+    for (n = 1; n <= cpus && n <= MAX_THREADS; n *= 2) {
+        double rw = run(&rw_dat, n);
+        double br = run(&br_dat, n);
+        printf("%7i  %12.2f  %12.2f\n", n, rw, br);
+    }
+    
+    aodbm_rwlock_destroy(&rwlock);
+    aodbm_brlock_destroy(&brlock);
+}
@@ -22,6 +22,7 @@
 
 #include "stdbool.h"
 #include "pthread.h"
+#include "sched.h"
 
 typedef struct {
     aodbm_rwlock_t *lock;
@@ -63,8 +64,73 @@ START_TEST (test_1) {
     aodbm_rwlock_destroy(&lock);
 } END_TEST
 
+typedef struct {
+    aodbm_brlock_t *lock;
+    volatile int *a;
+    volatile int *b;
+    volatile bool *failed;
+} brlock_data;
+
+static void *brlock_reader(void *ptr) {
+    brlock_data *dat = (brlock_data *)ptr;
+    int i;
+    for (i = 0; i < 100000; ++i) {
+        aodbm_brlock_rdlock(dat->lock);
+        if (*dat->a != *dat->b) {
+            *dat->failed = true;
+        }
+        aodbm_brlock_rdunlock(dat->lock);
+    }
+    return NULL;
+}
+
+static void *brlock_writer(void *ptr) {
+    brlock_data *dat = (brlock_data *)ptr;
+    int i;
+    for (i = 0; i < 1000; ++i) {
+        aodbm_brlock_wrlock(dat->lock);
+        *dat->a += 1;
+        sched_yield();
+        *dat->b += 1;
+        aodbm_brlock_wrunlock(dat->lock);
+    }
+    return NULL;
+}
+
+START_TEST (test_2) {
+    aodbm_brlock_t lock;
+    aodbm_brlock_init(&lock);
+    
+    volatile int a = 0, b = 0;
+    volatile bool failed = false;
+    brlock_data dat;
+    dat.lock = &lock;
+    dat.a = &a;
+    dat.b = &b;
+    dat.failed = &failed;
+    
+    pthread_t threads[6];
+    int i;
+    for (i = 0; i < 4; ++i) {
+        pthread_create(&threads[i], NULL, brlock_reader, (void *)&dat);
+    }
+    for (i = 4; i < 6; ++i) {
+        pthread_create(&threads[i], NULL, brlock_writer, (void *)&dat);
+    }
+    for (i = 0; i < 6; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+    
+    fail_unless(failed == false);
+    fail_unless(a == 2000);
+    fail_unless(b == 2000);
+    
+    aodbm_brlock_destroy(&lock);
+} END_TEST
+
 TCase *rwlock_test_case() {
     TCase *tc = tcase_create("rwlock");
     tcase_add_test(tc, test_1);
+    tcase_add_test(tc, test_2);
     return tc;
 }
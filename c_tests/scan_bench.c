@@ -0,0 +1,315 @@
+/*  
+    Copyright (C) 2011 aodbm authors,
+    
+    This file is part of aodbm.
+    
+    aodbm is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    aodbm is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "scan_bench.h"
+#include "aodbm.h"
+#include "aodbm_data.h"
+
+#include "stdio.h"
+#include "stdlib.h"
+#include "string.h"
+#include "time.h"
+#include "unistd.h"
+#include "fcntl.h"
+
+#define RECORDS 200000
+#define ROUNDS 5
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static aodbm_version fill(aodbm *db) {
+    aodbm_version ver = aodbm_current(db);
+    char buf[16];
+    unsigned int i;
+    for (i = 0; i < RECORDS; ++i) {
+        sprintf(buf, "key%07u", i);
+        aodbm_data *key = aodbm_data_from_str(buf);
+        aodbm_data *val = aodbm_data_from_str("a value of some length");
+        ver = aodbm_set(db, ver, key, val);
+        aodbm_free_data(key);
+        aodbm_free_data(val);
+    }
+    aodbm_commit(db, ver);
+    return ver;
+}
+
+static double scan_next(aodbm *db, aodbm_version ver) {
+    double start = now();
+    int round;
+    for (round = 0; round < ROUNDS; ++round) {
+        aodbm_iterator *it = aodbm_new_iterator(db, ver);
+        size_t n = 0;
+        aodbm_record rec;
+        while ((rec = aodbm_iterator_next(db, it)).key != NULL) {
+            aodbm_free_data(rec.key);
+            aodbm_free_data(rec.val);
+            n += 1;
+        }
+        aodbm_free_iterator(it);
+        if (n != RECORDS) {
+            printf("scan_next: expected %i records, got %zu\n", RECORDS, n);
+        }
+    }
+    return RECORDS * ROUNDS / (now() - start);
+}
+
+static double scan_batch(aodbm *db, aodbm_version ver) {
+    size_t buf_size = 65536;
+    char *buf = malloc(buf_size);
+    double start = now();
+    int round;
+    for (round = 0; round < ROUNDS; ++round) {
+        aodbm_iterator *it = aodbm_new_iterator(db, ver);
+        size_t n = 0, count;
+        while (aodbm_iterator_next_batch(db, it, buf, buf_size, &count) != 0) {
+            n += count;
+        }
+        aodbm_free_iterator(it);
+        if (n != RECORDS) {
+            printf("scan_batch: expected %i records, got %zu\n", RECORDS, n);
+        }
+    }
+    double rate = RECORDS * ROUNDS / (now() - start);
+    free(buf);
+    return rate;
+}
+
+/* the last 10 records before a random key, with a reverse range iterator */
+static double top_n(aodbm *db, aodbm_version ver) {
+    char buf[16];
+    double start = now();
+    int i, j;
+    for (i = 0; i < 20000; ++i) {
+        sprintf(buf, "key%07u", rand() % RECORDS);
+        aodbm_data *end = aodbm_data_from_str(buf);
+        aodbm_iterator *it = aodbm_iterate_range(db, ver, NULL, end, true);
+        for (j = 0; j < 10; ++j) {
+            aodbm_record rec = aodbm_iterator_prev(db, it);
+            if (rec.key == NULL) {
+                break;
+            }
+            aodbm_free_data(rec.key);
+            aodbm_free_data(rec.val);
+        }
+        aodbm_free_iterator(it);
+        aodbm_free_data(end);
+    }
+    return 20000 / (now() - start);
+}
+
+/* opens a page of 10 records at a random index, by skipping records with
+   aodbm_iterator_next or with aodbm_iterate_from_index */
+static void pages(aodbm *db, aodbm_version ver) {
+    double skip_time = 0.0, index_time = 0.0;
+    uint64_t j;
+    int i;
+    for (i = 0; i < 20; ++i) {
+        uint64_t index = rand() % RECORDS;
+        double start = now();
+        aodbm_iterator *it = aodbm_new_iterator(db, ver);
+        for (j = 0; j < index + 10; ++j) {
+            aodbm_record rec = aodbm_iterator_next(db, it);
+            aodbm_free_data(rec.key);
+            aodbm_free_data(rec.val);
+        }
+        aodbm_free_iterator(it);
+        skip_time += now() - start;
+        
+        start = now();
+        it = aodbm_iterate_from_index(db, ver, index);
+        for (j = 0; j < 10; ++j) {
+            aodbm_record rec = aodbm_iterator_next(db, it);
+            aodbm_free_data(rec.key);
+            aodbm_free_data(rec.val);
+        }
+        aodbm_free_iterator(it);
+        index_time += now() - start;
+    }
+    printf("pages per second, skipping: %.0f, aodbm_iterate_from_index: %.0f\n",
+           20 / skip_time,
+           20 / index_time);
+}
+
+/* seeks forward through the keys, step keys at a time, reading the record at
+   each, with aodbm_iterator_goto on one iterator or with a new iterator for
+   every seek */
+static void seeks(aodbm *db, aodbm_version ver, unsigned int step) {
+    char buf[16];
+    unsigned int i;
+    size_t n = 0;
+    double start = now();
+    aodbm_iterator *it = aodbm_new_iterator(db, ver);
+    for (i = 0; i < RECORDS; i += step) {
+        sprintf(buf, "key%07u", i);
+        aodbm_data *key = aodbm_data_from_str(buf);
+        aodbm_iterator_goto(db, it, key);
+        aodbm_record rec = aodbm_iterator_next(db, it);
+        aodbm_free_data(rec.key);
+        aodbm_free_data(rec.val);
+        aodbm_free_data(key);
+        n += 1;
+    }
+    aodbm_free_iterator(it);
+    double goto_time = now() - start;
+    
+    start = now();
+    for (i = 0; i < RECORDS; i += step) {
+        sprintf(buf, "key%07u", i);
+        aodbm_data *key = aodbm_data_from_str(buf);
+        it = aodbm_iterate_from(db, ver, key);
+        aodbm_record rec = aodbm_iterator_next(db, it);
+        aodbm_free_data(rec.key);
+        aodbm_free_data(rec.val);
+        aodbm_free_iterator(it);
+        aodbm_free_data(key);
+    }
+    double new_time = now() - start;
+    printf("forward seeks of %u keys per second, aodbm_iterator_goto: %.0f, "
+           "new iterators: %.0f\n",
+           step,
+           n / goto_time,
+           n / new_time);
+}
+
+static void count_record(size_t part,
+                         aodbm_data *key,
+                         aodbm_data *val,
+                         void *ctx) {
+    __sync_fetch_and_add((size_t *)ctx, 1);
+}
+
+static double parallel(aodbm *db, aodbm_version ver, size_t threads) {
+    double start = now();
+    int round;
+    for (round = 0; round < ROUNDS; ++round) {
+        size_t n = 0;
+        aodbm_parallel_scan(db, ver, NULL, NULL, threads, count_record, &n);
+        if (n != RECORDS) {
+            printf("parallel: expected %i records, got %zu\n", RECORDS, n);
+        }
+    }
+    return RECORDS * ROUNDS / (now() - start);
+}
+
+/* drops the database's pages from the page cache so the next scan has to go
+   to the disk */
+static void evict() {
+    int fd = open("benchdb", O_RDONLY);
+    fdatasync(fd);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+}
+
+static double cold_scan(aodbm *db, aodbm_version ver) {
+    double total = 0.0;
+    int round;
+    for (round = 0; round < ROUNDS; ++round) {
+        evict();
+        double start = now();
+        aodbm_iterator *it = aodbm_new_iterator(db, ver);
+        aodbm_record rec;
+        while ((rec = aodbm_iterator_next(db, it)).key != NULL) {
+            aodbm_free_data(rec.key);
+            aodbm_free_data(rec.val);
+        }
+        aodbm_free_iterator(it);
+        total += now() - start;
+    }
+    return RECORDS * ROUNDS / total;
+}
+
+/* lists the keys of a database with 2KiB values, with aodbm_iterator_next and
+   with aodbm_iterator_next_key, which doesn't read the values */
+static void key_scan() {
+    unlink("benchdb");
+    aodbm *db = aodbm_open("benchdb", 0);
+    aodbm_version ver = aodbm_current(db);
+    char *big = malloc(2048);
+    memset(big, 'v', 2048);
+    aodbm_data val = {big, 2048};
+    char buf[16];
+    unsigned int i;
+    for (i = 0; i < 5000; ++i) {
+        sprintf(buf, "key%07u", i);
+        aodbm_data *key = aodbm_data_from_str(buf);
+        ver = aodbm_set(db, ver, key, &val);
+        aodbm_free_data(key);
+    }
+    free(big);
+    
+    double start = now();
+    int round;
+    for (round = 0; round < ROUNDS; ++round) {
+        aodbm_iterator *it = aodbm_new_iterator(db, ver);
+        aodbm_record rec;
+        while ((rec = aodbm_iterator_next(db, it)).key != NULL) {
+            aodbm_free_data(rec.key);
+            aodbm_free_data(rec.val);
+        }
+        aodbm_free_iterator(it);
+    }
+    double next_time = now() - start;
+    
+    start = now();
+    for (round = 0; round < ROUNDS; ++round) {
+        aodbm_iterator *it = aodbm_new_iterator(db, ver);
+        aodbm_data *key;
+        while ((key = aodbm_iterator_next_key(db, it)) != NULL) {
+            aodbm_free_data(key);
+        }
+        aodbm_free_iterator(it);
+    }
+    double key_time = now() - start;
+    printf("keys per second with 2KiB values, aodbm_iterator_next: %.0f, "
+           "aodbm_iterator_next_key: %.0f\n",
+           5000 * ROUNDS / next_time,
+           5000 * ROUNDS / key_time);
+    
+    aodbm_close(db);
+    unlink("benchdb");
+}
+
+void scan_bench() {
+    unlink("benchdb");
+    aodbm *db = aodbm_open("benchdb", 0);
+    aodbm_version ver = fill(db);
+    
+    printf("full scans, records per second, %i records\n", RECORDS);
+    printf("aodbm_iterator_next: %.0f\n", scan_next(db, ver));
+    printf("aodbm_iterator_next_batch: %.0f\n", scan_batch(db, ver));
+    printf("aodbm_iterator_next, cold: %.0f\n", cold_scan(db, ver));
+    printf("top 10 queries per second: %.0f\n", top_n(db, ver));
+    pages(db, ver);
+    seeks(db, ver, 2);
+    seeks(db, ver, 1000);
+    printf("aodbm_parallel_scan, records per second\n");
+    size_t threads;
+    for (threads = 1; threads <= 8; threads *= 2) {
+        printf("%zu threads: %.0f\n", threads, parallel(db, ver, threads));
+    }
+    
+    aodbm_close(db);
+    unlink("benchdb");
+    
+    key_scan();
+}
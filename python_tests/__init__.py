@@ -20,5 +20,22 @@
 import unittest
 import simple_test
 import big_test
+import history_test
+import feed_test
+import replication_test
+import shared_test
+import order_test
+import compress_test
+import dedup_test
+import layout_test
 
-tests = unittest.TestSuite([simple_test.tests, big_test.tests])
+tests = unittest.TestSuite([simple_test.tests,
+                            big_test.tests,
+                            history_test.tests,
+                            feed_test.tests,
+                            replication_test.tests,
+                            shared_test.tests,
+                            order_test.tests,
+                            compress_test.tests,
+                            dedup_test.tests,
+                            layout_test.tests])
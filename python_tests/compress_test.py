@@ -0,0 +1,77 @@
+'''  
+    Copyright (C) 2011 aodbm authors,
+    
+    This file is part of aodbm.
+    
+    aodbm is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    aodbm is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+'''
+
+import unittest, aodbm, os
+
+def record(n):
+    return ('event:%06i' % n,
+            '{"user": %i, "type": "click", "page": "/items/%i"}' % (n % 17, n))
+
+class TestCompress(unittest.TestCase):
+    def setUp(self):
+        for name in ['testdb_compress', 'testdb_plain']:
+            if os.path.exists(name):
+                os.remove(name)
+    
+    def tearDown(self):
+        os.remove('testdb_compress')
+        os.remove('testdb_plain')
+    
+    def test_compress(self):
+        db = aodbm.AODBM('testdb_compress', aodbm.AODBM_COMPRESS)
+        plain = aodbm.AODBM('testdb_plain')
+        ver = db.current_version()
+        plain_ver = plain.current_version()
+        records = dict(record(n) for n in range(500))
+        for n in range(500):
+            key, val = record(n)
+            ver[key] = val
+            plain_ver[key] = val
+            if n == 100:
+                db.train_dictionary(ver)
+        self.assertEqual(list(ver), sorted(records.items()))
+        self.assertTrue(db.commit(ver))
+        self.assertTrue(os.path.getsize('testdb_compress') <
+                        os.path.getsize('testdb_plain'))
+        del db
+        del plain
+        os.remove('testdb_plain')
+        
+        # the dictionary is found when the database is opened again
+        db = aodbm.AODBM('testdb_compress')
+        ver = db.current_version()
+        self.assertEqual(list(ver), sorted(records.items()))
+        self.assertEqual(ver['event:000042'], records['event:000042'])
+        self.assertEqual(list(ver.keys()), sorted(records))
+        
+        # and by followers
+        follower = aodbm.AODBM('testdb_plain', aodbm.AODBM_FOLLOWER)
+        fd = os.open('testdb_log', os.O_RDWR | os.O_CREAT | os.O_TRUNC)
+        db.ship_log(0, fd)
+        os.lseek(fd, 0, os.SEEK_SET)
+        while follower.ingest_log(fd):
+            pass
+        os.close(fd)
+        os.remove('testdb_log')
+        self.assertEqual(list(follower.current_version()),
+                         sorted(records.items()))
+
+tests = [TestCompress]
+tests = map(unittest.TestLoader().loadTestsFromTestCase, tests)
+tests = unittest.TestSuite(tests)
@@ -0,0 +1,74 @@
+'''  
+    Copyright (C) 2011 aodbm authors,
+    
+    This file is part of aodbm.
+    
+    aodbm is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    aodbm is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+'''
+
+import unittest, aodbm, os
+
+class TestDedup(unittest.TestCase):
+    def setUp(self):
+        for name in ['testdb_dedup', 'testdb_plain']:
+            if os.path.exists(name):
+                os.remove(name)
+    
+    def tearDown(self):
+        os.remove('testdb_dedup')
+        os.remove('testdb_plain')
+    
+    def test_dedup(self):
+        db = aodbm.AODBM('testdb_dedup', aodbm.AODBM_DEDUP)
+        plain = aodbm.AODBM('testdb_plain')
+        ver = db.current_version()
+        plain_ver = plain.current_version()
+        blobs = ['%s' % chr(ord('a') + n) * 1000 for n in range(4)]
+        records = {}
+        for n in range(200):
+            key = 'key%03i' % n
+            # short values are kept in the leaves
+            val = blobs[n % 4] if n % 5 != 0 else 'short%i' % n
+            records[key] = val
+            ver[key] = val
+            plain_ver[key] = val
+        self.assertTrue(os.path.getsize('testdb_dedup') * 4 <
+                        os.path.getsize('testdb_plain'))
+        self.assertEqual(ver['key001'], blobs[1])
+        self.assertEqual(ver['key005'], 'short5')
+        self.assertEqual(list(ver), sorted(records.items()))
+        
+        # rewriting a value only writes a reference to it
+        size = os.path.getsize('testdb_dedup')
+        new_ver = ver.set_record('key002', blobs[2])
+        self.assertTrue(os.path.getsize('testdb_dedup') - size < 500)
+        new_ver = new_ver.set_record('key002', blobs[3])
+        self.assertEqual(ver.diff(new_ver), [('key002', blobs[3])])
+        del new_ver['key001']
+        self.assertFalse('key001' in new_ver)
+        self.assertEqual(new_ver['key003'], blobs[3])
+        self.assertTrue(db.commit(ver))
+        del db
+        
+        # values stored apart are read without the flag
+        db = aodbm.AODBM('testdb_dedup')
+        ver = db.current_version()
+        self.assertEqual(list(ver), sorted(records.items()))
+        # and a new value is stored in the leaf
+        ver['key999'] = blobs[0]
+        self.assertEqual(ver['key999'], blobs[0])
+
+tests = [TestDedup]
+tests = map(unittest.TestLoader().loadTestsFromTestCase, tests)
+tests = unittest.TestSuite(tests)
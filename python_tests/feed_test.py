@@ -0,0 +1,105 @@
+'''  
+    Copyright (C) 2011 aodbm authors,
+    
+    This file is part of aodbm.
+    
+    aodbm is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    aodbm is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+'''
+
+import unittest, aodbm, random, os
+
+class TestFeed(unittest.TestCase):
+    def setUp(self):
+        if os.path.exists('testdb_feed'):
+            os.remove('testdb_feed')
+        self.db = aodbm.AODBM('testdb_feed')
+    
+    def tearDown(self):
+        del self.db
+        os.remove('testdb_feed')
+    
+    def test_diff(self):
+        base = aodbm.Version(self.db, 0)
+        for n in range(200):
+            base = base.set_record('key%03i' % n, 'val' + str(n))
+        ver = base.set_record('key005', 'changed')
+        ver = ver.set_record('new', 'record')
+        ver = ver.del_key('key150')
+        # records are given in key order, shorter keys first
+        self.assertEqual(base.diff(ver), [('new', 'record'),
+                                          ('key005', 'changed'),
+                                          ('key150', None)])
+        self.assertEqual(ver.diff(base), [('new', None),
+                                          ('key005', 'val5'),
+                                          ('key150', 'val150')])
+        self.assertEqual(ver.diff(ver), [])
+        self.assertEqual(aodbm.Version(self.db, 0).diff(base),
+                         list(base))
+    
+    def test_random_diff(self):
+        nums = range(300)
+        random.shuffle(nums)
+        a = aodbm.Version(self.db, 0)
+        for n in nums:
+            a = a.set_record(str(n), str(n))
+        b = a
+        expected = {}
+        for n in random.sample(nums, 60):
+            if n % 3 == 0:
+                b = b.del_key(str(n))
+                expected[str(n)] = None
+            else:
+                b = b.set_record(str(n), 'x' + str(n))
+                expected[str(n)] = 'x' + str(n)
+        self.assertEqual(a.diff(b), sorted(expected.items(),
+                                           key=lambda (k, v): (len(k), k)))
+    
+    def test_merge(self):
+        base = aodbm.Version(self.db, 0)
+        for n in range(50):
+            base = base.set_record('key' + str(n), 'val')
+        a = base.set_record('a', '1').del_key('key3')
+        b = base.set_record('b', '2').set_record('key7', 'changed')
+        merged = a.merge(b)
+        self.assertEqual(merged['a'], '1')
+        self.assertEqual(merged['b'], '2')
+        self.assertEqual(merged['key7'], 'changed')
+        self.assertFalse(merged.has('key3'))
+    
+    def test_feed(self):
+        feed = self.db.feed(0)
+        self.assertEqual(feed.poll(), None)
+        ver = self.db.current_version()
+        ver = ver.set_record('feed1', 'a')
+        ver = ver.set_record('feed2', 'b')
+        self.assertTrue(self.db.commit(ver))
+        ver = ver.del_key('feed1')
+        self.assertTrue(self.db.commit(ver))
+        seq, version, changes = feed.poll()
+        self.assertEqual(seq, 1)
+        self.assertEqual(changes, [('feed1', 'a'), ('feed2', 'b')])
+        seq, version, changes = feed.wait()
+        self.assertEqual(seq, 2)
+        self.assertEqual(version.version, ver.version)
+        self.assertEqual(changes, [('feed1', None)])
+        self.assertEqual(feed.poll(), None)
+        self.assertEqual(feed.cursor(), 2)
+        
+        # resume from a cursor
+        feed = self.db.feed(1)
+        self.assertEqual(feed.poll()[2], [('feed1', None)])
+
+tests = [TestFeed]
+tests = map(unittest.TestLoader().loadTestsFromTestCase, tests)
+tests = unittest.TestSuite(tests)
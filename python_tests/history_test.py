@@ -0,0 +1,97 @@
+'''  
+    Copyright (C) 2011 aodbm authors,
+    
+    This file is part of aodbm.
+    
+    aodbm is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    aodbm is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+'''
+
+import unittest, aodbm, os
+
+class TestHistory(unittest.TestCase):
+    def setUp(self):
+        if os.path.exists('testdb_history'):
+            os.remove('testdb_history')
+        self.db = aodbm.AODBM('testdb_history')
+    
+    def tearDown(self):
+        del self.db
+        os.remove('testdb_history')
+    
+    def test_based_on(self):
+        root = aodbm.Version(self.db, 0)
+        history = [root]
+        ver = root
+        for n in range(300):
+            ver = ver.set_record('key' + str(n % 7), 'val' + str(n))
+            history.append(ver)
+        for i in range(0, len(history), 13):
+            for j in range(0, len(history), 17):
+                self.assertEqual(history[i].is_based_on(history[j]), j <= i)
+    
+    def test_common_ancestor(self):
+        ver = aodbm.Version(self.db, 0)
+        for n in range(100):
+            ver = ver.set_record('key' + str(n), 'val')
+        base = ver
+        a = base
+        for n in range(150):
+            a = a.set_record('a' + str(n), 'val')
+        b = base
+        for n in range(40):
+            b = b.set_record('b' + str(n), 'val')
+        self.assertEqual(a.common_ancestor(b).version, base.version)
+        self.assertEqual(b.common_ancestor(a).version, base.version)
+        self.assertEqual(a.common_ancestor(base).version, base.version)
+        self.assertEqual(a.common_ancestor(a).version, a.version)
+        self.assertTrue(a.is_based_on(base))
+        self.assertFalse(a.is_based_on(b))
+        self.assertFalse(b.is_based_on(a))
+        other = aodbm.Version(self.db, 0).set_record('other', 'val')
+        self.assertEqual(a.common_ancestor(other).version, 0)
+
+    def test_commit_index(self):
+        ver = self.db.current_version()
+        committed = []
+        for n in range(20):
+            ver = ver.set_record('commit', str(n))
+            self.assertTrue(self.db.commit(ver))
+            committed.append(ver.version)
+        self.assertEqual(self.db.current_seq(), 20)
+        for n in range(20):
+            seq = n + 1
+            self.assertEqual(self.db.version_at_seq(seq).version, committed[n])
+            time = self.db.commit_time(seq)
+            self.assertTrue(self.db.seq_at_time(time) >= seq)
+            self.assertEqual(self.db.version_at_time(time)['commit'],
+                             self.db.version_at_seq(self.db.seq_at_time(time))['commit'])
+        self.assertEqual(self.db.seq_at_time(0), 0)
+        self.assertEqual(self.db.version_at_time(0).version, 0)
+        last = self.db.commit_time(20)
+        # sequence numbers without a commit give 0
+        self.assertEqual(self.db.version_at_seq(21).version, 0)
+        self.assertEqual(self.db.commit_time(21), 0)
+        self.assertEqual(self.db.commit_time(0), 0)
+        self.assertEqual(self.db.version_at_time(last + 1).version, committed[-1])
+        
+        # the index is rebuilt when the database is reopened
+        del self.db
+        self.db = aodbm.AODBM('testdb_history')
+        self.assertEqual(self.db.current_seq(), 20)
+        self.assertEqual(self.db.commit_time(20), last)
+        self.assertEqual(self.db.version_at_seq(1).version, committed[0])
+
+tests = [TestHistory]
+tests = map(unittest.TestLoader().loadTestsFromTestCase, tests)
+tests = unittest.TestSuite(tests)
@@ -0,0 +1,148 @@
+'''  
+    Copyright (C) 2011 aodbm authors,
+    
+    This file is part of aodbm.
+    
+    aodbm is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    aodbm is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+'''
+
+import unittest, aodbm, os, struct
+
+# the size of a version header and of a node header
+VERSION_HEADER_SIZE = 24
+NODE_HEADER_SIZE = 13
+
+def read_varint(data, pos):
+    n, shift = 0, 0
+    while True:
+        byte = ord(data[pos])
+        pos += 1
+        n |= (byte & 0x7f) << shift
+        shift += 7
+        if byte < 0x80:
+            return n, pos
+
+def tree_nodes(filename, ver):
+    '''Gives the offset and size of every node of a version'''
+    data = open(filename, 'rb').read()
+    stack = [ver + VERSION_HEADER_SIZE]
+    while stack:
+        off = stack.pop()
+        kind, sz, keys_sz, vals_sz = \
+            struct.unpack('>cIII', data[off:off + NODE_HEADER_SIZE])
+        if sz & 0x80000000:
+            # a compressed node's header holds its stored size
+            yield off, NODE_HEADER_SIZE + keys_sz
+        else:
+            yield off, NODE_HEADER_SIZE + keys_sz + vals_sz
+        if kind == 'b':
+            # the children are the distances back from the branch
+            pos = off + NODE_HEADER_SIZE + keys_sz
+            for i in range(sz + 1):
+                back, pos = read_varint(data, pos)
+                stack.append(off - back)
+
+class TestLayout(unittest.TestCase):
+    def setUp(self):
+        for name in ['testdb_layout', 'testdb_packed']:
+            if os.path.exists(name):
+                os.remove(name)
+    
+    def tearDown(self):
+        for name in ['testdb_layout', 'testdb_packed']:
+            if os.path.exists(name):
+                os.remove(name)
+    
+    def test_align(self):
+        db = aodbm.AODBM('testdb_layout')
+        # a small alignment, so that most nodes are padded
+        db.align_nodes(128)
+        ver = db.current_version()
+        records = {}
+        for n in range(1000):
+            key, val = 'key%04i' % (n * 7 % 1000), 'val' * (n % 13)
+            records[key] = val
+            ver[key] = val
+        for n in range(0, 1000, 3):
+            del ver['key%04i' % n]
+            del records['key%04i' % n]
+        self.assertEqual(list(ver), sorted(records.items()))
+        self.assertEqual(ver['key0500'], records['key0500'])
+        self.assertTrue(db.commit(ver))
+        committed = ver.version
+        del db
+        
+        # no node that fits in 128 bytes crosses a multiple of 128
+        fitting = 0
+        for off, sz in tree_nodes('testdb_layout', committed):
+            if sz <= 128:
+                fitting += 1
+                self.assertTrue(off % 128 + sz <= 128)
+        self.assertTrue(fitting > 100)
+        
+        db = aodbm.AODBM('testdb_layout')
+        ver = db.current_version()
+        self.assertEqual(list(ver), sorted(records.items()))
+        # nodes written without alignment can be mixed with aligned ones
+        ver['key1000'] = 'val'
+        self.assertEqual(ver['key1000'], 'val')
+        self.assertEqual(len(list(ver)), len(records) + 1)
+
+    def test_repack(self):
+        db = aodbm.AODBM('testdb_layout', order=aodbm.AODBM_ORDER_LEX)
+        ver = db.current_version()
+        records = {}
+        for n in range(2000):
+            key, val = 'key%04i' % (n * 7 % 2000), 'val%i' % n
+            records[key] = val
+            ver[key] = val
+        for n in range(0, 2000, 3):
+            del ver['key%04i' % n]
+            del records['key%04i' % n]
+        self.assertTrue(ver.repack('testdb_packed'))
+        # an existing file is left alone
+        size = os.path.getsize('testdb_packed')
+        self.assertFalse(ver.repack('testdb_packed'))
+        self.assertEqual(os.path.getsize('testdb_packed'), size)
+        self.assertTrue(os.path.getsize('testdb_packed') * 10 <
+                        os.path.getsize('testdb_layout'))
+        
+        packed = aodbm.AODBM('testdb_packed')
+        self.assertEqual(packed.current_seq(), 1)
+        pver = packed.current_version()
+        self.assertEqual(pver.previous().version, 0)
+        self.assertEqual(list(pver), sorted(records.items()))
+        self.assertEqual(list(reversed(pver)), sorted(records.items())[::-1])
+        self.assertEqual(pver.count(), len(records))
+        self.assertEqual(pver.rank('key1000'), ver.rank('key1000'))
+        self.assertEqual(list(pver.iterate_prefix('key19')),
+                         list(ver.iterate_prefix('key19')))
+        self.assertFalse('key0003' in pver)
+        # the copy can be updated like any other database
+        pver['key0003'] = 'new'
+        del pver['key0004']
+        self.assertEqual(pver['key0003'], 'new')
+        self.assertFalse('key0004' in pver)
+        self.assertTrue(packed.commit(pver))
+        
+        # an empty version makes a database with one empty commit
+        del packed
+        os.remove('testdb_packed')
+        db.current_version().repack('testdb_packed')
+        packed = aodbm.AODBM('testdb_packed')
+        self.assertEqual(list(packed.current_version()), [])
+
+tests = [TestLayout]
+tests = map(unittest.TestLoader().loadTestsFromTestCase, tests)
+tests = unittest.TestSuite(tests)
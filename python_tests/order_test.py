@@ -0,0 +1,238 @@
+'''  
+    Copyright (C) 2011 aodbm authors,
+    
+    This file is part of aodbm.
+    
+    aodbm is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    aodbm is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+'''
+
+import unittest, aodbm, os, struct, random
+
+class TestOrder(unittest.TestCase):
+    def setUp(self):
+        if os.path.exists('testdb_order'):
+            os.remove('testdb_order')
+    
+    def tearDown(self):
+        os.remove('testdb_order')
+    
+    def fill(self, db, keys):
+        ver = db.current_version()
+        for key in keys:
+            ver[key] = key
+        return ver
+    
+    def assertOrder(self, ver, keys):
+        self.assertEqual([k for k, v in ver], keys)
+        for key in keys:
+            self.assertEqual(ver[key], key)
+        self.assertEqual(ver.get_many(keys), keys)
+    
+    def test_default(self):
+        db = aodbm.AODBM('testdb_order', 0, aodbm.AODBM_ORDER_DEFAULT)
+        ver = self.fill(db, ['ab', 'b', '', 'a'])
+        self.assertOrder(ver, ['', 'a', 'b', 'ab'])
+    
+    def test_lex(self):
+        db = aodbm.AODBM('testdb_order', 0, aodbm.AODBM_ORDER_LEX)
+        keys = ['b', 'ab', 'a', '', 'ba', '\xff', '\x01', 'abc', 'aa']
+        keys += [str(random.random()) for n in range(100)]
+        random.shuffle(keys)
+        ver = self.fill(db, keys)
+        self.assertOrder(ver, sorted(keys))
+    
+    def test_integers(self):
+        nums = range(-300, 300, 7) + [-2 ** 63, 2 ** 63 - 1]
+        random.shuffle(nums)
+        db = aodbm.AODBM('testdb_order', 0, aodbm.AODBM_ORDER_I64)
+        ver = self.fill(db, [struct.pack('>q', n) for n in nums])
+        self.assertOrder(ver, [struct.pack('>q', n) for n in sorted(nums)])
+        del db
+        os.remove('testdb_order')
+        
+        nums = [n + 2 ** 63 for n in nums]
+        db = aodbm.AODBM('testdb_order', 0, aodbm.AODBM_ORDER_U64)
+        ver = self.fill(db, [struct.pack('>Q', n) for n in nums])
+        self.assertOrder(ver, [struct.pack('>Q', n) for n in sorted(nums)])
+    
+    def test_custom(self):
+        reverse = lambda a, b: cmp(b, a)
+        db = aodbm.AODBM('testdb_order', 0, aodbm.AODBM_ORDER_CUSTOM, reverse)
+        keys = [str(n) for n in range(100)]
+        random.shuffle(keys)
+        ver = self.fill(db, keys)
+        self.assertOrder(ver, sorted(keys, reverse=True))
+        
+        other = ver.del_key('42').set_record('5', 'changed')
+        self.assertEqual(ver.diff(other), [('5', 'changed'), ('42', None)])
+        self.assertTrue(db.commit(other))
+        del db
+        
+        db = aodbm.AODBM('testdb_order', 0, aodbm.AODBM_ORDER_CUSTOM, reverse)
+        ver = db.current_version()
+        self.assertFalse(ver.has('42'))
+        self.assertEqual(ver['5'], 'changed')
+    
+    def check_random(self, db, make_key, order=None):
+        ver = db.current_version()
+        model = {}
+        for n in range(600):
+            key = make_key(random.randrange(200))
+            if random.random() < 0.3:
+                del ver[key]
+                model.pop(key, None)
+            else:
+                ver[key] = str(n)
+                model[key] = str(n)
+        order = order or (lambda k: k)
+        records = sorted(model.items(), key=lambda (k, v): order(k))
+        self.assertEqual(list(ver), records)
+        self.assertEqual(list(ver.keys()), [k for k, v in records])
+        for n in range(200):
+            key = make_key(n)
+            self.assertEqual(ver.has(key), key in model)
+        keys = [make_key(n) for n in range(200)]
+        self.assertEqual(ver.get_many(keys), [model.get(k) for k in keys])
+        for key in keys[::7]:
+            it = ver.iterate_from(key)
+            expected = [(k, v) for k, v in records if order(k) >= order(key)]
+            self.assertEqual(list(it), expected)
+        self.assertEqual(list(reversed(ver)), records[::-1])
+        self.assertEqual(ver.count(), len(records))
+        for key in keys[::5]:
+            rank = len([k for k, v in records if order(k) < order(key)])
+            self.assertEqual(ver.rank(key), rank)
+            self.assertEqual(ver.count(key), len(records) - rank)
+            self.assertEqual(ver.count(None, key), rank)
+        for n in [1, 3, 8]:
+            parts = [list(it) for it in ver.partition(n)]
+            self.assertEqual(len(parts), min(n, len(records)))
+            self.assertEqual(sum(parts, []), records)
+            self.assertTrue(max(map(len, parts)) - min(map(len, parts)) <= 1)
+        parts = {}
+        def collect(part, key, val):
+            parts.setdefault(part, []).append((key, val))
+        ver.parallel_scan(3, collect)
+        self.assertEqual(sum([parts[i] for i in sorted(parts)], []), records)
+        start, end = keys[20], keys[150]
+        if order(end) < order(start):
+            start, end = end, start
+        parts = [list(it) for it in ver.partition(4, start, end)]
+        self.assertEqual(sum(parts, []),
+                         [(k, v) for k, v in records
+                          if order(start) <= order(k) < order(end)])
+        for key in keys[::17]:
+            for prefix in [key[:1], key[:3], key[:7], key, key + '\x00']:
+                self.assertEqual(list(ver.iterate_prefix(prefix)),
+                                 [(k, v) for k, v in records
+                                  if k.startswith(prefix)])
+        it = iter(ver)
+        for key in keys[::3] + keys[::-5]:
+            it.goto(key)
+            expected = [(k, v) for k, v in records if order(k) >= order(key)]
+            self.assertEqual(next(it, None), (expected or [None])[0])
+        for index in range(0, len(records) + 2, 9):
+            self.assertEqual(list(ver.iterate_from_index(index)),
+                             records[index:])
+        for start, end in zip(keys[::11], keys[::-13]):
+            if order(end) < order(start):
+                start, end = end, start
+            expected = [(k, v) for k, v in records
+                        if order(start) <= order(k) < order(end)]
+            self.assertEqual(list(ver.iterate_range(start, end)), expected)
+            self.assertEqual(ver.count(start, end), len(expected))
+            self.assertEqual(list(ver.iterate_range(start, end, True)),
+                             expected[::-1])
+            self.assertEqual(list(ver.iterate_range(None, end, True)),
+                             [(k, v) for k, v in records
+                              if order(k) < order(end)][::-1])
+            self.assertEqual(list(ver.iterate_range(start, None)),
+                             [(k, v) for k, v in records
+                              if order(k) >= order(start)])
+    
+    def test_fixed_width(self):
+        db = aodbm.AODBM('testdb_order', 0, aodbm.AODBM_ORDER_LEX, None, 16)
+        self.check_random(db, lambda n: struct.pack('>QQ', n % 3, n))
+        del db
+        # the width is recorded in the file
+        db = aodbm.AODBM('testdb_order')
+        ver = db.current_version()
+        ver[struct.pack('>QQ', 1, 1)] = 'one'
+        self.assertEqual(ver[struct.pack('>QQ', 1, 1)], 'one')
+        del db
+        os.remove('testdb_order')
+        
+        # integer keys are searched as integers
+        db = aodbm.AODBM('testdb_order', 0, aodbm.AODBM_ORDER_I64)
+        self.check_random(db, lambda n: struct.pack('>q', n - 100),
+                          lambda k: struct.unpack('>q', k)[0])
+        del db
+        os.remove('testdb_order')
+        
+        db = aodbm.AODBM('testdb_order', 0, aodbm.AODBM_ORDER_DEFAULT, None, 8)
+        self.check_random(db, lambda n: struct.pack('>q', n * 99991),
+                          lambda k: struct.unpack('>8b', k))
+    
+    def test_prefix(self):
+        keys = ['user:%i:%s' % (n, field) for n in range(40)
+                for field in ['name', 'profile', 'email']]
+        keys += ['user:4', 'user:', 'user', 'users', 'user;', '\xff\xff',
+                 '\xff\xff\x00', '\xff\xfe']
+        prefixes = ['user:4', 'user:4:', 'user:', 'user', 'u', '', 'x',
+                    '\xff', '\xff\xff', 'user:39:email', 'user:39:emails']
+        for order in [aodbm.AODBM_ORDER_LEX, aodbm.AODBM_ORDER_DEFAULT]:
+            db = aodbm.AODBM('testdb_order', 0, order)
+            ver = self.fill(db, keys)
+            for prefix in prefixes:
+                self.assertEqual([k for k, v in ver.iterate_prefix(prefix)],
+                                 [k for k, v in ver if k.startswith(prefix)])
+            del db
+            os.remove('testdb_order')
+        # random lexicographic keys
+        db = aodbm.AODBM('testdb_order', 0, aodbm.AODBM_ORDER_LEX)
+        self.check_random(db, lambda n: 'k%i:%i' % (n % 7, n))
+    
+    def test_separators(self):
+        # keys with long shared prefixes, and lengths that vary, so that
+        # branches are given keys shorter than the records'
+        make_key = lambda n: 'tenant-%03i/event/%s%i' % (n % 5,
+                                                         'x' * (n % 13), n)
+        db = aodbm.AODBM('testdb_order', 0, aodbm.AODBM_ORDER_LEX)
+        self.check_random(db, make_key)
+        del db
+        os.remove('testdb_order')
+        db = aodbm.AODBM('testdb_order', 0, aodbm.AODBM_ORDER_DEFAULT)
+        self.check_random(db, make_key, lambda k: (len(k), k))
+    
+    def test_reopen(self):
+        db = aodbm.AODBM('testdb_order', 0, aodbm.AODBM_ORDER_LEX)
+        self.assertTrue(db.commit(self.fill(db, ['b', 'aa'])))
+        del db
+        
+        # the order is taken from the file
+        db = aodbm.AODBM('testdb_order')
+        ver = self.fill(db, ['a', 'ab'])
+        self.assertOrder(ver, ['a', 'aa', 'ab', 'b'])
+        del db
+        
+        # opening with a different order is an error
+        pid = os.fork()
+        if pid == 0:
+            aodbm.AODBM('testdb_order', 0, aodbm.AODBM_ORDER_DEFAULT)
+            os._exit(0)
+        self.assertNotEqual(os.waitpid(pid, 0)[1], 0)
+
+tests = [TestOrder]
+tests = map(unittest.TestLoader().loadTestsFromTestCase, tests)
+tests = unittest.TestSuite(tests)
@@ -0,0 +1,75 @@
+'''  
+    Copyright (C) 2011 aodbm authors,
+    
+    This file is part of aodbm.
+    
+    aodbm is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    aodbm is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+'''
+
+import unittest, aodbm, os
+
+class TestReplication(unittest.TestCase):
+    def setUp(self):
+        self.db = aodbm.AODBM('testdb')
+        self.follower = aodbm.AODBM('testdb_follower', aodbm.AODBM_FOLLOWER)
+    
+    def tearDown(self):
+        del self.follower
+        os.remove('testdb_follower')
+    
+    def sync(self):
+        fd = os.open('testdb_log', os.O_RDWR | os.O_CREAT | os.O_TRUNC)
+        end = self.db.ship_log(self.follower.log_size(), fd)
+        os.lseek(fd, 0, os.SEEK_SET)
+        while self.follower.ingest_log(fd):
+            pass
+        os.close(fd)
+        os.remove('testdb_log')
+        self.assertEqual(self.follower.log_size(), end)
+    
+    def test_follow(self):
+        ver = self.db.current_version()
+        for n in range(100):
+            ver = ver.set_record('key' + str(n), 'val' + str(n))
+        self.assertTrue(self.db.commit(ver))
+        self.sync()
+        self.assertEqual(self.follower.current_seq(), self.db.current_seq())
+        copy = self.follower.current_version()
+        self.assertEqual(copy.version, ver.version)
+        self.assertEqual(list(copy), list(ver))
+        
+        # only the new part of the log is shipped
+        feed = self.follower.feed(self.follower.current_seq())
+        ver = ver.set_record('key5', 'changed')
+        self.assertTrue(self.db.commit(ver))
+        size = self.follower.log_size()
+        self.sync()
+        self.assertTrue(self.follower.log_size() > size)
+        self.assertEqual(self.follower.current_version()['key5'], 'changed')
+        self.assertEqual(feed.poll()[2], [('key5', 'changed')])
+        
+        # nothing to ship
+        self.sync()
+        self.assertFalse(self.follower.commit(self.follower.current_version()))
+        
+        # nothing can be written through the follower
+        copy = self.follower.current_version()
+        self.assertEqual(copy.set_record('key5', 'again').version, 0)
+        self.assertEqual(copy.del_key('key5').version, 0)
+        self.follower.train_dictionary(copy)
+        self.assertEqual(self.follower.log_size(), self.db.log_size())
+
+tests = [TestReplication]
+tests = map(unittest.TestLoader().loadTestsFromTestCase, tests)
+tests = unittest.TestSuite(tests)
@@ -0,0 +1,85 @@
+'''  
+    Copyright (C) 2011 aodbm authors,
+    
+    This file is part of aodbm.
+    
+    aodbm is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    aodbm is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+'''
+
+import unittest, aodbm, os
+
+class TestShared(unittest.TestCase):
+    def setUp(self):
+        self.db = aodbm.AODBM('testdb_shared', aodbm.AODBM_SHARED)
+    
+    def tearDown(self):
+        del self.db
+        os.remove('testdb_shared')
+        os.remove('testdb_shared.head')
+    
+    def test_reader(self):
+        ver = self.db.current_version()
+        ver = ver.set_record('hello', 'world')
+        self.assertTrue(self.db.commit(ver))
+        
+        reader = aodbm.AODBM('testdb_shared', aodbm.AODBM_READER)
+        self.assertEqual(reader.current_version()['hello'], 'world')
+        
+        # uncommitted versions aren't visible to readers
+        ver = ver.set_record('hello', 'again')
+        self.assertEqual(reader.current_version()['hello'], 'world')
+        self.assertEqual(reader.current_seq(), self.db.current_seq())
+        
+        feed = reader.feed(reader.current_seq())
+        self.assertTrue(self.db.commit(ver))
+        self.assertEqual(reader.current_version()['hello'], 'again')
+        self.assertEqual(reader.current_seq(), self.db.current_seq())
+        self.assertEqual(feed.wait()[2], [('hello', 'again')])
+        self.assertFalse(reader.commit(reader.current_version()))
+    
+    def test_reader_process(self):
+        ver = self.db.current_version()
+        for n in range(50):
+            ver = ver.set_record('key' + str(n), 'val' + str(n))
+        self.assertTrue(self.db.commit(ver))
+        read_fd, write_fd = os.pipe()
+        ready_read_fd, ready_write_fd = os.pipe()
+        pid = os.fork()
+        if pid == 0:
+            os.close(write_fd)
+            os.close(ready_read_fd)
+            status = 1
+            try:
+                reader = aodbm.AODBM('testdb_shared', aodbm.AODBM_READER)
+                ok = reader.current_version()['key7'] == 'val7'
+                # let the parent make its next commit and wait for it
+                os.write(ready_write_fd, 'x')
+                os.read(read_fd, 1)
+                ok = ok and reader.current_version()['key7'] == 'changed'
+                status = 0 if ok else 1
+            finally:
+                os._exit(status)
+        os.close(read_fd)
+        os.close(ready_write_fd)
+        os.read(ready_read_fd, 1)
+        os.close(ready_read_fd)
+        ver = ver.set_record('key7', 'changed')
+        self.assertTrue(self.db.commit(ver))
+        os.write(write_fd, 'x')
+        os.close(write_fd)
+        self.assertEqual(os.waitpid(pid, 0)[1], 0)
+
+tests = [TestShared]
+tests = map(unittest.TestLoader().loadTestsFromTestCase, tests)
+tests = unittest.TestSuite(tests)
@@ -27,9 +27,11 @@ class TestSimple(unittest.TestCase):
         # a simple test with one record
         ver = aodbm.Version(self.db, 0)
         self.assertRaises(KeyError, ver.__getitem__, 'hello')
+        self.assertEqual(ver.count(), 0)
         self.assertFalse(ver.has('test'))
         ver['test'] = 'hello'
         self.assertEqual(ver['test'], 'hello')
+        self.assertEqual(ver.count(), 1)
         self.assertTrue(ver.has('test'))
         del ver['test']
         self.assertRaises(KeyError, ver.__getitem__, 'test')
@@ -46,6 +48,91 @@ class TestSimple(unittest.TestCase):
         ver['hello'] = 'world'
         self.assertTrue(ver.has('hello'))
         self.assertEqual(ver['hello'], 'world')
+    
+    def test_get_many(self):
+        ver = aodbm.Version(self.db, 0)
+        self.assertEqual(ver.get_many(['a', 'b']), [None, None])
+        for i in range(200):
+            ver[str(i)] = str(i * 2)
+        # unsorted, with duplicates and missing keys
+        keys = ['150', 'missing', '3', '150', '', '0', '199', '200', '42']
+        expected = [ver[k] if ver.has(k) else None for k in keys]
+        self.assertEqual(ver.get_many(keys), expected)
+        self.assertEqual(ver.get_many([]), [])
+        keys = [str(i) for i in range(200)]
+        self.assertEqual(ver.get_many(keys), [str(i * 2) for i in range(200)])
+    
+    def test_iterate_batches(self):
+        ver = aodbm.Version(self.db, 0)
+        expected = []
+        for i in range(300):
+            # some values larger than the iterator's buffer
+            val = str(i) * (70000 if i % 100 == 7 else 1)
+            ver[str(i)] = val
+            expected.append((str(i), val))
+        expected.sort(key=lambda (k, v): (len(k), k))
+        self.assertEqual(list(ver), expected)
+        it = iter(ver)
+        it.next()
+        it.goto('150')
+        self.assertEqual(list(it), expected[150:])
+    
+    def test_next_and_prev(self):
+        ver = aodbm.Version(self.db, 0)
+        for i in range(100):
+            ver['%02i' % i] = str(i)
+        lib = aodbm.aodbm_lib
+        def step(it, forward):
+            if forward:
+                rec = lib.aodbm_iterator_next(self.db.db, it)
+            else:
+                rec = lib.aodbm_iterator_prev(self.db.db, it)
+            if not rec.key:
+                return None
+            key = aodbm.data_to_str(rec.key.contents)
+            lib.aodbm_free_data(rec.key)
+            lib.aodbm_free_data(rec.val)
+            return key
+        it = lib.aodbm_iterate_range(self.db.db, ver.version,
+                                     aodbm.str_to_data('10'),
+                                     aodbm.str_to_data('20'), False)
+        self.assertEqual(step(it, False), None)
+        self.assertEqual([step(it, True) for i in range(11)],
+                         ['%02i' % i for i in range(10, 20)] + [None])
+        # the iterator stays at the end of the range and can go back
+        self.assertEqual(step(it, False), '19')
+        self.assertEqual(step(it, False), '18')
+        self.assertEqual(step(it, True), '18')
+        lib.aodbm_free_iterator(it)
+        it = lib.aodbm_new_iterator(self.db.db, ver.version)
+        for i in range(100):
+            step(it, True)
+        self.assertEqual(step(it, True), None)
+        self.assertEqual([step(it, False) for i in range(3)], ['99', '98', '97'])
+        lib.aodbm_free_iterator(it)
+    
+    def test_keys(self):
+        ver = aodbm.Version(self.db, 0)
+        for i in range(100):
+            ver['%02i' % i] = str(i) * 1000
+        self.assertEqual(list(ver.keys()), ['%02i' % i for i in range(100)])
+        # values are read when they're needed after skipping over keys
+        it = iter(ver)
+        self.assertEqual([it.next_key() for i in range(10)],
+                         ['%02i' % i for i in range(10)])
+        self.assertEqual(it.next(), ('10', '10' * 1000))
+        it.goto('50')
+        self.assertEqual(it.next_key(), '50')
+        self.assertEqual(it.next(), ('51', '51' * 1000))
+        
+        # a reverse iterator gives keys backwards too
+        it = reversed(ver)
+        self.assertEqual(it.next(), ('99', '99' * 1000))
+        self.assertEqual([it.next_key() for i in range(3)], ['98', '97', '96'])
+        self.assertEqual(it.next(), ('95', '95' * 1000))
+        it = ver.iterate_range('10', '13', reverse=True)
+        self.assertEqual([it.next_key() for i in range(3)], ['12', '11', '10'])
+        self.assertRaises(StopIteration, it.next_key)
 
 tests = [TestSimple]
 tests = map(unittest.TestLoader().loadTestsFromTestCase, tests)